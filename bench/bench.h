@@ -0,0 +1,40 @@
+/*
+ * Shared helpers of the stash benchmarks.
+ * Each benchmark is a single file built on its own, from the repository root:
+ *
+ *   cc -O2 -march=native -I. bench/bench_<name>.c -o bench_<name> [-pthread]
+ */
+
+#ifndef STASH_BENCH_H
+#define STASH_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t bench_rand(uint64_t* state)
+{
+    // xorshift64, good enough to scatter benchmark keys
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static inline size_t bench_arg(int argc, char** argv, int index, size_t fallback)
+{
+    return (argc > index) ? (size_t)strtoull(argv[index], NULL, 10) : fallback;
+}
+
+static volatile uint64_t bench_sink;    //< Keeps the measured loops from being optimized out
+
+#endif // STASH_BENCH_H
@@ -0,0 +1,128 @@
+/*
+ * Read throughput of stash_cmap with 1 to N reader threads while one writer keeps
+ * updating, against a stash_umap behind a mutex.
+ *
+ *   cc -O2 -march=native -pthread -I. bench/bench_cmap.c -o bench_cmap && ./bench_cmap [max threads]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+#define STASH_IMPL
+#include "stash.h"
+#include "bench/bench.h"
+
+#include <pthread.h>
+
+#define KEYS 100000
+#define DURATION 1.0    // Seconds per measurement
+
+static stash_cmap cmap;
+static stash_umap umap;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int done;
+static int use_cmap;
+
+static void* reader(void* arg)
+{
+    uint64_t state = 7919 * (uint64_t)(uintptr_t)arg + 1;
+    uint64_t reads = 0, sum = 0, value;
+
+    while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < 64; i++, reads++) {
+            uint32_t key = (uint32_t)(bench_rand(&state) % KEYS);
+
+            if (use_cmap) {
+                if (stash_cmap_get(&cmap, key, &value) == STASH_SUCCESS) sum += value;
+            }
+            else {
+                pthread_mutex_lock(&lock);
+                if (stash_umap_get(&umap, key, &value) == STASH_SUCCESS) sum += value;
+                pthread_mutex_unlock(&lock);
+            }
+        }
+    }
+
+    bench_sink = sum;
+    return (void*)(uintptr_t)reads;
+}
+
+static void* writer(void* arg)
+{
+    uint64_t state = 42;
+    (void)arg;
+
+    // About one update per 10 microseconds, a read-mostly workload
+    struct timespec pause = { 0, 10000 };
+
+    while (!__atomic_load_n(&done, __ATOMIC_RELAXED)) {
+        uint32_t key = (uint32_t)(bench_rand(&state) % KEYS);
+        uint64_t value = bench_rand(&state);
+
+        if (use_cmap) {
+            stash_cmap_set(&cmap, key, &value);
+        }
+        else {
+            pthread_mutex_lock(&lock);
+            stash_umap_remove(&umap, key, NULL);
+            stash_umap_insert(&umap, key, &value);
+            pthread_mutex_unlock(&lock);
+        }
+        nanosleep(&pause, NULL);
+    }
+
+    return NULL;
+}
+
+static double run(int threads)
+{
+    pthread_t readers[64], update;
+    uint64_t reads = 0;
+
+    done = 0;
+    pthread_create(&update, NULL, writer, NULL);
+    for (intptr_t i = 0; i < threads; i++) {
+        pthread_create(&readers[i], NULL, reader, (void*)i);
+    }
+
+    double start = bench_now();
+    struct timespec duration = { (time_t)DURATION, (long)((DURATION - (time_t)DURATION) * 1e9) };
+    nanosleep(&duration, NULL);
+    __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+
+    for (int i = 0; i < threads; i++) {
+        void* count;
+        pthread_join(readers[i], &count);
+        reads += (uint64_t)(uintptr_t)count;
+    }
+    pthread_join(update, NULL);
+
+    return (double)reads / (bench_now() - start) / 1e6;
+}
+
+int main(int argc, char** argv)
+{
+    int max_threads = (int)bench_arg(argc, argv, 1, 8);
+    if (max_threads > 64) max_threads = 64;
+
+    cmap = stash_cmap_create(KEYS, sizeof(uint64_t));
+    umap = stash_umap_create(KEYS, sizeof(uint64_t));
+
+    for (uint64_t key = 0; key < KEYS; key++) {
+        stash_cmap_insert(&cmap, (uint32_t)key, &key);
+        stash_umap_insert(&umap, (uint32_t)key, &key);
+    }
+
+    printf("%d keys, one writer, million reads per second\n", KEYS);
+    printf("threads   stash_cmap   mutex + stash_umap\n");
+
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        use_cmap = 1;
+        double lock_free = run(threads);
+        use_cmap = 0;
+        double locked = run(threads);
+        printf("%7d   %10.1f   %18.1f\n", threads, lock_free, locked);
+    }
+
+    stash_cmap_destroy(&cmap);
+    stash_umap_destroy(&umap);
+    return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Batched lookups (stash_umap_get_many / stash_umap_find_many)
+ * against a loop of stash_umap_get, half of the keys being missing.
+ *
+ *   cc -O2 -march=native -I. bench/bench_get_many.c -o bench_get_many && ./bench_get_many [keys]
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "bench/bench.h"
+
+#define BLOCK 4096   // Keys given to each batched call
+
+static void run(size_t n)
+{
+    stash_umap table = stash_umap_create(n, sizeof(uint64_t));
+    uint32_t* present = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint64_t state = 88172645463325252ULL;
+
+    for (size_t i = 0; i < n; i++) {
+        present[i] = (uint32_t)bench_rand(&state) & ~1u;   //< Stored keys are even
+        uint64_t value = present[i];
+        stash_umap_insert(&table, present[i], &value);
+    }
+
+    size_t queries = 4000000;
+    uint32_t* keys = (uint32_t*)malloc(queries * sizeof(uint32_t));
+    uint64_t* values = (uint64_t*)malloc(BLOCK * sizeof(uint64_t));
+    void** pointers = (void**)malloc(BLOCK * sizeof(void*));
+    uint8_t* found = (uint8_t*)malloc(BLOCK);
+
+    // Every other query is a stored key, the others are odd and miss
+    for (size_t i = 0; i < queries; i++) {
+        uint32_t r = (uint32_t)bench_rand(&state);
+        keys[i] = (i % 2 == 0) ? present[r % n] : (r | 1u);
+    }
+
+    uint64_t sum = 0;
+    double t0 = bench_now();
+    for (size_t i = 0; i < queries; i++) {
+        uint64_t value;
+        if (stash_umap_get(&table, keys[i], &value) == STASH_SUCCESS) sum += value;
+    }
+
+    double t1 = bench_now();
+    for (size_t i = 0; i < queries; i += BLOCK) {
+        size_t count = (queries - i < BLOCK) ? queries - i : BLOCK;
+        stash_umap_get_many(&table, keys + i, count, values, found);
+        for (size_t j = 0; j < count; j++) {
+            if (found[j]) sum += values[j];
+        }
+    }
+
+    double t2 = bench_now();
+    for (size_t i = 0; i < queries; i += BLOCK) {
+        size_t count = (queries - i < BLOCK) ? queries - i : BLOCK;
+        stash_umap_find_many(&table, keys + i, count, pointers);
+        for (size_t j = 0; j < count; j++) {
+            if (pointers[j]) sum += *(const uint64_t*)pointers[j];
+        }
+    }
+
+    double t3 = bench_now();
+    bench_sink = sum;
+
+    printf("%9zu keys   get loop %6.1f ns   get_many %6.1f ns   find_many %6.1f ns\n", n,
+        (t1 - t0) * 1e9 / queries, (t2 - t1) * 1e9 / queries, (t3 - t2) * 1e9 / queries);
+
+    free(present);
+    free(keys);
+    free(values);
+    free(pointers);
+    free(found);
+    stash_umap_destroy(&table);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = bench_arg(argc, argv, 1, 0);
+
+    if (n != 0) {
+        run(n);
+        return 0;
+    }
+
+    // From cache resident to well past the last level cache
+    run(10000);
+    run(1000000);
+    run(16000000);
+
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Throughput and probe lengths of the stash_umap hash functions
+ * on sequential, strided, clustered and random keys.
+ *
+ *   cc -O2 -march=native -I. bench/bench_hash.c -o bench_hash && ./bench_hash [keys]
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "bench/bench.h"
+
+typedef struct {
+    const char* name;
+    stash_hash_fn hash;
+} hash_case;
+
+static void fill_keys(uint32_t* keys, size_t n, int pattern)
+{
+    uint64_t state = 88172645463325252ULL;
+    uint32_t base = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        switch (pattern) {
+        case 0: keys[i] = (uint32_t)i; break;                //< Sequential IDs
+        case 1: keys[i] = (uint32_t)i << 10; break;          //< Strided (e.g. aligned addresses)
+        case 2:                                               //< Runs of 64 IDs at random bases
+            if (i % 64 == 0) base = (uint32_t)bench_rand(&state) & ~63u;
+            keys[i] = base + (uint32_t)(i % 64);
+            break;
+        default: keys[i] = (uint32_t)bench_rand(&state); break;
+        }
+    }
+}
+
+static void run(const hash_case* hash, const uint32_t* keys, size_t n)
+{
+    stash_umap table = stash_umap_create(16, sizeof(uint32_t));
+    stash_umap_set_hash(&table, hash->hash, 0);
+
+    double t0 = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        stash_umap_insert(&table, keys[i], &keys[i]);
+    }
+
+    double t1 = bench_now();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        sum += *(const uint32_t*)stash_umap_find_const(&table, keys[i]);
+    }
+
+    double t2 = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        sum += stash_umap_contains(&table, keys[i] + 0x9E3779B9u);
+    }
+
+    double t3 = bench_now();
+    bench_sink = sum;
+
+    stash_umap_info info;
+    stash_umap_stats(&table, &info);
+
+    printf("  %-10s insert %6.1f  hit %6.1f  miss %6.1f ns   avg probe %5.2f  max %3zu   hist",
+        hash->name, (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n, (t3 - t2) * 1e9 / n, info.avg_probe, info.max_probe);
+
+    // Share of the keys at probe length 1, 2, 3, 4 and beyond
+    size_t beyond = 0;
+    for (size_t i = 0; i < STASH_UMAP_PROBE_BINS; i++) {
+        if (i < 4) printf(" %5.1f%%", 100.0 * info.probe_histogram[i] / n);
+        else beyond += info.probe_histogram[i];
+    }
+    printf(" %5.1f%%\n", 100.0 * beyond / n);
+
+    stash_umap_destroy(&table);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = bench_arg(argc, argv, 1, 1000000);
+    uint32_t* keys = (uint32_t*)malloc(n * sizeof(uint32_t));
+
+    const char* patterns[] = { "sequential", "strided (i << 10)", "clustered (runs of 64)", "random" };
+    const hash_case hashes[] = {
+        { "mix", stash_hash_mix },
+        { "identity", stash_hash_identity },
+        { "fibonacci", stash_hash_fibonacci }
+    };
+
+    printf("%zu keys, times per operation, probe histogram for lengths 1 2 3 4 5+\n", n);
+
+    for (int p = 0; p < 4; p++) {
+        printf("%s\n", patterns[p]);
+        fill_keys(keys, n, p);
+        for (size_t h = 0; h < sizeof(hashes) / sizeof(hashes[0]); h++) {
+            run(&hashes[h], keys, n);
+        }
+    }
+
+    free(keys);
+    return 0;
+}
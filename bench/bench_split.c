@@ -0,0 +1,64 @@
+/*
+ * Inline vs split (STASH_UMAP_SPLIT) layout of stash_umap:
+ * insertion, hits and misses with 32-byte values.
+ *
+ *   cc -O2 -march=native -I. bench/bench_split.c -o bench_split && ./bench_split [keys]
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "bench/bench.h"
+
+typedef struct {
+    uint64_t words[4];
+} value32;
+
+static void run(const char* name, uint32_t flags, const uint32_t* keys, size_t n)
+{
+    stash_umap table = stash_umap_create_ex(16, sizeof(value32), flags);
+    value32 value = { { 0 } };
+
+    double t0 = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        value.words[0] = keys[i];
+        stash_umap_insert(&table, keys[i], &value);
+    }
+
+    double t1 = bench_now();
+    uint64_t sum = 0;
+    for (size_t i = 0; i < n; i++) {
+        const value32* found = (const value32*)stash_umap_find_const(&table, keys[i]);
+        sum += found->words[0];
+    }
+
+    double t2 = bench_now();
+    for (size_t i = 0; i < n; i++) {
+        sum += stash_umap_contains(&table, keys[i] ^ 0x80000000u);    //< Keys are below 2^31, so these all miss
+    }
+
+    double t3 = bench_now();
+    bench_sink = sum;
+
+    printf("%-8s insert %6.1f ns   hit %6.1f ns   miss %6.1f ns\n", name,
+        (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n, (t3 - t2) * 1e9 / n);
+
+    stash_umap_destroy(&table);
+}
+
+int main(int argc, char** argv)
+{
+    size_t n = bench_arg(argc, argv, 1, 4000000);
+    uint32_t* keys = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint64_t state = 88172645463325252ULL;
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (uint32_t)bench_rand(&state) & 0x7FFFFFFFu;
+    }
+
+    printf("%zu random keys, 32-byte values\n", n);
+    run("inline", STASH_UMAP_INLINE, keys, n);
+    run("split", STASH_UMAP_SPLIT, keys, n);
+
+    free(keys);
+    return 0;
+}
@@ -43,9 +43,64 @@
 #   define STASH_FREE(mem) free(mem)
 #endif
 
+/* === Configuration === */
+
+#ifndef STASH_MAX_ALIGN
+#   define STASH_MAX_ALIGN 16   // Maximum alignment given to values stored inline
+#endif
+
+#ifndef STASH_UMAP_MAX_LOAD_FACTOR
+#   define STASH_UMAP_MAX_LOAD_FACTOR 0.75f   // Default load factor above which a table grows
+#endif
+
+#ifndef STASH_UMAP_MIGRATE_STEP
+#   define STASH_UMAP_MIGRATE_STEP 8   // Slots migrated per insert/remove during an incremental rehash
+#endif
+
+#ifndef STASH_UMAP_BATCH_SIZE
+#   define STASH_UMAP_BATCH_SIZE 16    // Keys hashed and prefetched ahead in batched lookups
+#endif
+
+#ifndef STASH_UMAP_HASH
+#   define STASH_UMAP_HASH stash_hash_mix  // Hash function given to new tables (see stash_hash_fn)
+#endif
+
+#ifndef STASH_CACHE_LINE
+#   define STASH_CACHE_LINE 64   // Alignment used to keep concurrently written data on separate cache lines
+#endif
+
+#ifndef STASH_UMAP_SMALL_SIZE
+#   define STASH_UMAP_SMALL_SIZE 8     // Keys kept inside a STASH_UMAP_SMALL table (multiple of 8, up to 32)
+#endif
+
+#if STASH_UMAP_SMALL_SIZE % 8 != 0 || STASH_UMAP_SMALL_SIZE > 32
+#   error "STASH_UMAP_SMALL_SIZE must be a multiple of 8, up to 32"
+#endif
+
+#ifndef STASH_UMAP_PROBE_BINS
+#   define STASH_UMAP_PROBE_BINS 16    // Bins of the probe length histogram given by stash_umap_stats()
+#endif
+
+#ifndef STASH_FMAP_GROUP_SIZE
+#   define STASH_FMAP_GROUP_SIZE 2     // Average keys sharing a displacement in a stash_fmap (more saves memory, builds slower)
+#endif
+
+#ifndef STASH_STATS
+//  define STASH_STATS   // Define to count lookups, misses and probe steps in every stash_umap (relaxed atomic adds with GCC/Clang)
+#endif
+
+#ifndef STASH_NO_MMAP
+//  define STASH_NO_MMAP   // Define to make stash_umap_map() read the file instead of mapping it
+#endif
+
+#ifndef STASH_SMAP_INLINE_KEY
+#   define STASH_SMAP_INLINE_KEY 15    // Longest string key stored inside its slot instead of the key arena
+#endif
+
 /* === Common Things === */
 
 enum {
+    STASH_ERROR_IO               = -4,
     STASH_ERROR_KEY_NOT_FOUND    = -3,
     STASH_ERROR_OUT_OF_BOUNDS    = -2,
     STASH_ERROR_OUT_OF_MEMORY    = -1,
@@ -69,18 +124,155 @@ typedef struct {
     size_t elem_size;        // Size of an element (in bytes)
 } stash_arr;
 
-typedef struct {
-    uint32_t key;           // ID Key
-    void* value;            // Pointer to the value
-    bool occupied;          // Indicates if the entry is occupied
-} stash_umap_entry;
+typedef uint64_t (*stash_hash_fn)(const void* key, size_t size, uint64_t seed);
 
 typedef struct {
-    stash_arr buckets;        // Bucket array
+    uint32_t key;           // ID Key (tables created with stash_umap_create_keyed hold 'key_size' bytes instead)
+} stash_umap_entry;         // The value bytes follow inline at 'value_offset' (unless split)
+
+enum {
+    STASH_UMAP_INLINE = 0,          // Each slot holds its key followed by its value (default)
+    STASH_UMAP_SPLIT = 1 << 0,      // Keys are stored densely, values in a separate array
+    STASH_UMAP_INCREMENTAL = 1 << 1,// Growth migrates entries a few at a time instead of all at once
+    STASH_UMAP_ORDERED = 1 << 2,    // Entries are packed in insertion order, buckets only index them
+    STASH_UMAP_SMALL = 1 << 3       // The first keys are kept in the struct, buckets are only allocated once they overflow
+};
+
+typedef struct stash_umap {
+    stash_arr buckets;        // Bucket array (key + inline value per slot, or keys only when split)
+    stash_arr values;         // Value array, only used by split tables
+    stash_arr ctrl;           // Control bytes, 7 bits of hash per full slot (high bit set when empty)
+    stash_arr dists;          // Distance of each entry from its home bucket (Robin Hood)
     size_t count;           // Number of elements in the table
+    size_t key_size;         // Size of the keys (4 for uint32_t keys)
     size_t value_size;       // Size of stored values
+    size_t value_offset;     // Offset of the value from the start of a slot
+    size_t growth_limit;     // Number of elements that triggers the next rehash
+    float max_load_factor;   // Maximum ratio of elements to buckets
+    stash_hash_fn hash;      // Hash function of the keys
+    uint64_t seed;           // Seed given to the hash function
+    uint32_t flags;          // Layout flags given at creation
+    struct stash_umap* old;  // Bucket array being migrated (incremental rehash only)
+    size_t migrate_pos;      // Next slot of 'old' to migrate
+    stash_arr entries;       // Dense key + value entries in insertion order (ordered only)
+    stash_arr live;          // Whether each dense entry is still in the table (ordered only)
+    size_t tombstones;       // Removed entries not yet compacted out of 'entries' (ordered only)
+    uint32_t small_keys[STASH_UMAP_SMALL_SIZE]; // Keys of a small table in insertion order, their values are in 'values'
+    void* mapping;           // Snapshot file holding the arrays (read-only tables from stash_umap_map)
+    size_t mapping_size;     // Size of 'mapping' in bytes
+#ifdef STASH_STATS
+    size_t lookups;          // Lookups performed since creation
+    size_t misses;           // Lookups that did not find their key
+    size_t probe_steps;      // Groups of control bytes scanned by lookups
+#endif
 } stash_umap;
 
+typedef struct {
+    size_t count;            // Number of elements
+    size_t bucket_count;     // Number of buckets (both arrays during an incremental rehash)
+    float load_factor;       // Elements per bucket
+    float avg_probe;         // Average probe length of the elements (1 when every element sits in its home bucket)
+    size_t max_probe;        // Longest probe length
+    size_t probe_histogram[STASH_UMAP_PROBE_BINS];  // Elements per probe length - 1, the last bin gathers the longer ones
+    size_t allocations;      // Memory blocks owned by the table
+    size_t bytes;            // Bytes owned by the table (capacity, not only what is in use)
+    size_t lookups;          // Counters of STASH_STATS builds, zero otherwise
+    size_t misses;
+    size_t probe_steps;
+} stash_umap_info;
+
+typedef struct {
+    stash_arr pilots;        // Displacement of each group of keys, chosen so that no two keys share a slot
+    stash_arr slots;         // Key followed by its value, exactly one slot per element
+    size_t count;            // Number of elements
+    size_t key_size;         // Size of the keys (4 for uint32_t keys)
+    size_t value_size;       // Size of stored values
+    size_t value_offset;     // Offset of the value from the start of a slot
+    uint64_t seed;           // Seed of the source table, mixed into the key hash
+    uint64_t salt;           // Mixed into the key hash too, changed until the keys could be placed
+} stash_fmap;
+
+typedef struct {
+    stash_umap table;        // Keys only (4 bytes per bucket), probed like any stash_umap
+} stash_uset;
+
+typedef struct {
+    stash_umap keys;         // Run of each key: offset, count and capacity of its values in 'values'
+    stash_arr values;        // Values of every key, each key's values are contiguous
+    size_t count;            // Number of values (all keys)
+    size_t garbage;          // Values left behind by runs that moved or were removed
+    size_t value_size;       // Size of stored values
+} stash_umultimap;
+
+typedef struct {
+    uint64_t hash;                          // Cached hash of the key (0 for empty slots)
+    uint32_t len;                           // Key length in bytes
+    uint32_t offset;                        // Offset of the key in the arena (long keys only)
+    char key[STASH_SMAP_INLINE_KEY + 1];    // Short keys, null terminated
+} stash_smap_slot;                          // The value bytes follow inline at 'value_offset'
+
+typedef struct {
+    stash_arr buckets;       // Bucket array (slot header + inline value)
+    stash_arr arena;         // Keys longer than STASH_SMAP_INLINE_KEY, null terminated
+    size_t arena_garbage;    // Arena bytes left behind by removed keys
+    size_t count;            // Number of elements in the map
+    size_t value_size;       // Size of stored values
+    size_t value_offset;     // Offset of the value from the start of a slot
+    size_t growth_limit;     // Number of elements that triggers the next rehash
+} stash_smap;
+
+typedef struct stash_cmap_table {
+    size_t mask;                        // Bucket count - 1
+    stash_arr keys;                     // Key of each bucket
+    stash_arr used;                     // Whether each bucket holds an entry
+    stash_arr values;                   // Value of each bucket, padded to whole 8-byte words
+    char* stripes;                      // Sequence counter of each stripe of buckets, one per STASH_CACHE_LINE, odd while written
+    size_t stripe_mask;                 // Stripe count - 1
+    void* stripe_memory;                // Allocation holding 'stripes'
+    struct stash_cmap_table* retired;   // Previous bucket arrays, kept for readers still walking them
+} stash_cmap_table;
+
+typedef struct {
+    stash_cmap_table* table;  // Current bucket arrays, swapped atomically on growth
+    size_t count;             // Number of elements in the map
+    size_t value_size;        // Size of stored values
+    size_t growth_limit;      // Number of elements that triggers the next growth
+} stash_cmap;
+
+typedef void (*stash_update_fn)(void* value, bool inserted, void* user);
+typedef void (*stash_visit_fn)(uint32_t key, void* value, void* user);
+
+typedef struct {
+    stash_umap table;         // Entries of the shard
+    uint32_t lock;            // Spinlock, non-zero while held
+} stash_shmap_shard;          // Each shard is padded to a multiple of STASH_CACHE_LINE
+
+typedef struct {
+    void* memory;             // Allocation holding the shards
+    char* shards;             // First shard, aligned on STASH_CACHE_LINE
+    size_t shard_stride;      // Distance between two shards
+    size_t shard_count;       // Number of shards (power of two)
+} stash_shmap;
+
+#define STASH_LFMAP_VALUE_MAX ((1ULL << 63) - 2)   // Largest value a stash_lfmap can hold
+
+typedef struct stash_lfmap_table {
+    size_t mask;                            // Bucket count - 1
+    stash_arr keys;                         // Keys, claimed with CAS (UINT32_MAX when free)
+    stash_arr values;                       // Values plus one, zero when unset
+    size_t used;                            // Claimed key slots
+    size_t copy_pos;                        // Next chunk to copy during a resize
+    size_t copied;                          // Slots already moved to 'next'
+    struct stash_lfmap_table* next;         // Larger table being filled during a resize
+    struct stash_lfmap_table* retired;      // Next table of the retired list
+} stash_lfmap_table;
+
+typedef struct {
+    stash_lfmap_table* table;     // Oldest table still in use
+    stash_lfmap_table* retired;   // Tables fully copied to their successor, freed by stash_lfmap_reclaim()
+    size_t count;                 // Number of keys with a value
+} stash_lfmap;
+
 typedef struct {
     stash_arr elements;       // Store the objects directly (contiguous)
     stash_arr valid_flags;     // Store if an ID is valid (Boolean array)
@@ -122,10 +314,26 @@ int stash_arr_pop_front(stash_arr* array, void* element);
 int stash_arr_pop_at(stash_arr* array, size_t index, void* element);
 bool stash_arr_compare(const stash_arr* a, const stash_arr* b);
 
+/* === Hash Functions === */
+
+uint64_t stash_hash_mix(const void* key, size_t size, uint64_t seed);         // Murmur3 finalizer (default)
+uint64_t stash_hash_identity(const void* key, size_t size, uint64_t seed);    // Key bits as is, for already random keys
+uint64_t stash_hash_fibonacci(const void* key, size_t size, uint64_t seed);   // Multiply-shift
+
 /* === Table Container === */
 
 stash_umap stash_umap_create(size_t initialCapacity, size_t value_size);
+stash_umap stash_umap_create_ex(size_t initialCapacity, size_t value_size, uint32_t flags);
+stash_umap stash_umap_create_keyed(size_t initialCapacity, size_t key_size, size_t value_size, uint32_t flags);
+stash_umap stash_umap_build(const uint32_t* keys, const void* values, size_t n, size_t value_size);
+stash_umap stash_umap_build_keyed(const void* keys, size_t key_size, const void* values, size_t n, size_t value_size, uint32_t flags);
 int stash_umap_reserve(stash_umap* table, size_t newCapacity);
+int stash_umap_rehash(stash_umap* table, size_t bucket_count);
+bool stash_umap_rehash_step(stash_umap* table, size_t steps);
+int stash_umap_shrink_to_fit(stash_umap* table);
+float stash_umap_load_factor(const stash_umap* table);
+int stash_umap_set_max_load_factor(stash_umap* table, float max_load_factor);
+int stash_umap_set_hash(stash_umap* table, stash_hash_fn hash, uint64_t seed);
 void stash_umap_destroy(stash_umap* table);
 bool stash_umap_is_valid(const stash_umap* table);
 bool stash_umap_is_empty(const stash_umap* table);
@@ -134,11 +342,149 @@ void stash_umap_previous(stash_umap* array, stash_it* it);
 void stash_umap_next(stash_umap* array, stash_it* it);
 stash_it stash_umap_end(stash_umap* array);
 int stash_umap_insert(stash_umap* table, uint32_t key, const void* value);
+void* stash_umap_emplace(stash_umap* table, uint32_t key, bool* inserted);
 int stash_umap_remove(stash_umap* table, uint32_t key, void* element);
 int stash_umap_get(const stash_umap* table, uint32_t key, void* element);
+void* stash_umap_find(stash_umap* table, uint32_t key);
+const void* stash_umap_find_const(const stash_umap* table, uint32_t key);
 bool stash_umap_contains(const stash_umap* table, uint32_t key);
+size_t stash_umap_get_many(const stash_umap* table, const uint32_t* keys, size_t n, void* elements, uint8_t* found);
+size_t stash_umap_find_many(stash_umap* table, const uint32_t* keys, size_t n, void** values);
 void stash_umap_clear(stash_umap* table);
 size_t stash_umap_count(const stash_umap* table);
+int stash_umap_insert_key(stash_umap* table, const void* key, const void* value);
+void* stash_umap_emplace_key(stash_umap* table, const void* key, bool* inserted);
+int stash_umap_remove_key(stash_umap* table, const void* key, void* element);
+int stash_umap_get_key(const stash_umap* table, const void* key, void* element);
+void* stash_umap_find_key(stash_umap* table, const void* key);
+const void* stash_umap_find_key_const(const stash_umap* table, const void* key);
+bool stash_umap_contains_key(const stash_umap* table, const void* key);
+int stash_umap_stats(const stash_umap* table, stash_umap_info* info);
+int stash_umap_save(const stash_umap* table, const char* path);
+int stash_umap_map(stash_umap* table, const char* path, stash_hash_fn hash);
+
+/* === Frozen Table Container === */
+
+int stash_umap_freeze(const stash_umap* table, stash_fmap* frozen);
+void stash_fmap_destroy(stash_fmap* map);
+bool stash_fmap_is_valid(const stash_fmap* map);
+int stash_fmap_get(const stash_fmap* map, uint32_t key, void* element);
+const void* stash_fmap_find(const stash_fmap* map, uint32_t key);
+bool stash_fmap_contains(const stash_fmap* map, uint32_t key);
+int stash_fmap_get_key(const stash_fmap* map, const void* key, void* element);
+const void* stash_fmap_find_key(const stash_fmap* map, const void* key);
+bool stash_fmap_contains_key(const stash_fmap* map, const void* key);
+size_t stash_fmap_count(const stash_fmap* map);
+
+/* === Set Container === */
+
+stash_uset stash_uset_create(size_t initialCapacity);
+int stash_uset_reserve(stash_uset* set, size_t newCapacity);
+void stash_uset_destroy(stash_uset* set);
+bool stash_uset_is_valid(const stash_uset* set);
+int stash_uset_insert(stash_uset* set, uint32_t key);
+int stash_uset_remove(stash_uset* set, uint32_t key);
+bool stash_uset_contains(const stash_uset* set, uint32_t key);
+size_t stash_uset_count(const stash_uset* set);
+void stash_uset_clear(stash_uset* set);
+void stash_uset_for_each(const stash_uset* set, stash_visit_fn visit, void* user);
+int stash_uset_union(stash_uset* set, const stash_uset* other);
+int stash_uset_intersection(stash_uset* set, const stash_uset* other);
+int stash_uset_difference(stash_uset* set, const stash_uset* other);
+
+/* === Multimap Container === */
+
+stash_umultimap stash_umultimap_create(size_t initialCapacity, size_t value_size);
+void stash_umultimap_destroy(stash_umultimap* map);
+bool stash_umultimap_is_valid(const stash_umultimap* map);
+int stash_umultimap_insert(stash_umultimap* map, uint32_t key, const void* value);
+int stash_umultimap_remove(stash_umultimap* map, uint32_t key);
+int stash_umultimap_remove_at(stash_umultimap* map, uint32_t key, size_t index, void* element);
+void* stash_umultimap_equal_range(stash_umultimap* map, uint32_t key, size_t* count);
+const void* stash_umultimap_equal_range_const(const stash_umultimap* map, uint32_t key, size_t* count);
+bool stash_umultimap_contains(const stash_umultimap* map, uint32_t key);
+size_t stash_umultimap_count(const stash_umultimap* map);
+size_t stash_umultimap_key_count(const stash_umultimap* map);
+void stash_umultimap_clear(stash_umultimap* map);
+void stash_umultimap_for_each(stash_umultimap* map, stash_visit_fn visit, void* user);
+
+/* === String Table Container === */
+
+stash_smap stash_smap_create(size_t initialCapacity, size_t value_size);
+int stash_smap_reserve(stash_smap* map, size_t newCapacity);
+void stash_smap_destroy(stash_smap* map);
+bool stash_smap_is_valid(const stash_smap* map);
+bool stash_smap_is_empty(const stash_smap* map);
+stash_it stash_smap_begin(stash_smap* map);
+void stash_smap_previous(stash_smap* map, stash_it* it);
+void stash_smap_next(stash_smap* map, stash_it* it);
+stash_it stash_smap_end(stash_smap* map);
+const char* stash_smap_key(const stash_smap* map, const stash_it* it, size_t* len);
+int stash_smap_insert(stash_smap* map, const char* key, size_t len, const void* value);
+void* stash_smap_emplace(stash_smap* map, const char* key, size_t len, bool* inserted);
+int stash_smap_remove(stash_smap* map, const char* key, size_t len, void* element);
+int stash_smap_get(const stash_smap* map, const char* key, size_t len, void* element);
+void* stash_smap_find(stash_smap* map, const char* key, size_t len);
+const void* stash_smap_find_const(const stash_smap* map, const char* key, size_t len);
+bool stash_smap_contains(const stash_smap* map, const char* key, size_t len);
+void stash_smap_clear(stash_smap* map);
+size_t stash_smap_count(const stash_smap* map);
+
+/* === Concurrent Table Container === */
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// Lock-free readers (get, contains, count) may run on any number of threads,
+// writers (insert, set, remove, reclaim, destroy) must be serialized by the caller
+stash_cmap stash_cmap_create(size_t initialCapacity, size_t value_size);
+void stash_cmap_destroy(stash_cmap* map);
+bool stash_cmap_is_valid(const stash_cmap* map);
+void stash_cmap_reclaim(stash_cmap* map);
+int stash_cmap_insert(stash_cmap* map, uint32_t key, const void* value);
+int stash_cmap_set(stash_cmap* map, uint32_t key, const void* value);
+int stash_cmap_remove(stash_cmap* map, uint32_t key, void* element);
+int stash_cmap_get(const stash_cmap* map, uint32_t key, void* element);
+bool stash_cmap_contains(const stash_cmap* map, uint32_t key);
+size_t stash_cmap_count(const stash_cmap* map);
+
+#endif // __GNUC__ || __clang__
+
+/* === Sharded Table Container === */
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// Safe to call from any number of threads, except create and destroy
+stash_shmap stash_shmap_create(size_t shard_count, size_t initialCapacity, size_t value_size);
+void stash_shmap_destroy(stash_shmap* map);
+bool stash_shmap_is_valid(const stash_shmap* map);
+int stash_shmap_insert(stash_shmap* map, uint32_t key, const void* value);
+int stash_shmap_update(stash_shmap* map, uint32_t key, stash_update_fn update, void* user);
+int stash_shmap_remove(stash_shmap* map, uint32_t key, void* element);
+int stash_shmap_get(stash_shmap* map, uint32_t key, void* element);
+bool stash_shmap_contains(stash_shmap* map, uint32_t key);
+size_t stash_shmap_count(stash_shmap* map);
+size_t stash_shmap_shard_count(const stash_shmap* map);
+void stash_shmap_for_each(stash_shmap* map, size_t shard_index, stash_visit_fn visit, void* user);
+
+#endif // __GNUC__ || __clang__
+
+/* === Lock-Free Table Container === */
+
+#if defined(__GNUC__) || defined(__clang__)
+
+// Every function is lock-free and thread-safe except create, destroy and reclaim.
+// Keys cannot be removed and UINT32_MAX is reserved.
+stash_lfmap stash_lfmap_create(size_t initialCapacity);
+void stash_lfmap_destroy(stash_lfmap* map);
+bool stash_lfmap_is_valid(const stash_lfmap* map);
+void stash_lfmap_reclaim(stash_lfmap* map);
+int stash_lfmap_insert(stash_lfmap* map, uint32_t key, uint64_t value);
+int stash_lfmap_store(stash_lfmap* map, uint32_t key, uint64_t value);
+int stash_lfmap_fetch_add(stash_lfmap* map, uint32_t key, uint64_t delta, uint64_t* previous);
+int stash_lfmap_get(stash_lfmap* map, uint32_t key, uint64_t* value);
+size_t stash_lfmap_count(const stash_lfmap* map);
+
+#endif // __GNUC__ || __clang__
 
 /* === Registry Container === */
 
@@ -187,6 +533,12 @@ static inline int64_t u_stash_next_po2_u64(int64_t x)
     return x;
 }
 
+static inline int64_t u_stash_ceil_po2_u64(int64_t x)
+{
+    // Smallest power of two greater than or equal to x
+    return (x <= 1) ? 1 : u_stash_next_po2_u64(x - 1);
+}
+
 /* === Public Array Implementation === */
 
 stash_arr stash_arr_create(size_t capacity, size_t elem_size)
@@ -585,458 +937,5006 @@ bool stash_arr_compare(const stash_arr* a, const stash_arr* b)
     return !memcmp(a->data, b->data, a->count * a->elem_size);
 }
 
-/* === Private Table Implementation === */
+/* === Private Group Probing === */
+
+// Control bytes of a table are scanned one group at a time,
+// a group being 32 (AVX2), 16 (SSE2) or 8 (portable SWAR) slots.
+// Define STASH_NO_SIMD to force the portable implementation.
+
+#if !defined(STASH_NO_SIMD) && defined(__AVX2__)
+#   include <immintrin.h>
+#   define STASH_UMAP_GROUP_WIDTH 32
+#   define U_STASH_GROUP_SHIFT 0
+#elif !defined(STASH_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   include <emmintrin.h>
+#   define STASH_UMAP_GROUP_WIDTH 16
+#   define U_STASH_GROUP_SHIFT 0
+#else
+#   define STASH_UMAP_GROUP_WIDTH 8
+#   define U_STASH_GROUP_SHIFT 3    //< One bit out of eight is meaningful in SWAR masks
+#endif
 
-static inline size_t u_stash_umap_hash_u32(uint32_t key, size_t capacity)
-{
-    // Murmur3 algorithm
+#if defined(_MSC_VER)
+#   include <intrin.h>
+#endif
 
-    key ^= key >> 16;
-    key *= 0x85ebca6b;
-    key ^= key >> 13;
-    key *= 0xc2b2ae35;
-    key ^= key >> 16;
+#if defined(__GNUC__) || defined(__clang__)
+#   define U_STASH_PREFETCH(addr) __builtin_prefetch(addr)
+#elif defined(_MSC_VER) && STASH_UMAP_GROUP_WIDTH > 8
+#   define U_STASH_PREFETCH(addr) _mm_prefetch((const char*)(addr), _MM_HINT_T0)
+#else
+#   define U_STASH_PREFETCH(addr) ((void)(addr))
+#endif
 
-    return key % capacity;
-}
+// Lookups take a const table but bump its counters, the only state a reader writes: the adds are
+// atomic so that several threads may look up the same table at once (a table must then never be
+// an object defined const). Other compilers add plainly, concurrent readers may lose counts.
+#if defined(STASH_STATS) && (defined(__GNUC__) || defined(__clang__))
+#   define U_STASH_UMAP_STAT(table, field, n) ((void)__atomic_fetch_add(&((stash_umap*)(table))->field, (size_t)(n), __ATOMIC_RELAXED))
+#   define U_STASH_UMAP_STAT_LOAD(table, field) __atomic_load_n(&(table)->field, __ATOMIC_RELAXED)
+#elif defined(STASH_STATS)
+#   define U_STASH_UMAP_STAT(table, field, n) ((void)(((stash_umap*)(table))->field += (size_t)(n)))
+#   define U_STASH_UMAP_STAT_LOAD(table, field) ((table)->field)
+#else
+#   define U_STASH_UMAP_STAT(table, field, n) ((void)0)
+#endif
 
-static int64_t u_stash_find_entry_index(const stash_umap* table, uint32_t key)
-{
-    if (!stash_umap_is_valid(table) || table->buckets.count == 0) {
-        return -1;
-    }
+#define U_STASH_CTRL_EMPTY ((uint8_t)0x80)
+#define U_STASH_DIST_MAX 255        //< Longest probe distance a slot can record, longer ones saturate to it
 
-    size_t capacity = table->buckets.count;
-    size_t index = u_stash_umap_hash_u32(key, capacity);
-    size_t original_index = index;
+static inline size_t u_stash_umap_dist_cap(size_t dist)
+{
+    // A saturated slot is at least that far from its home, so it never ends a probe early
+    return (dist < U_STASH_DIST_MAX) ? dist : U_STASH_DIST_MAX;
+}
 
-    // Linear probing collision resolution
-    do {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, index);
-        if (entry && entry->occupied && entry->key == key) {
-            return (int64_t)index;
-        }
+static inline unsigned u_stash_ctz_u64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return (unsigned)__builtin_ctzll(x);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+    unsigned long index;
+    _BitScanForward64(&index, x);
+    return (unsigned)index;
+#else
+    unsigned n = 0;
+    while (!(x & 1)) { x >>= 1; n++; }
+    return n;
+#endif
+}
 
-        if (entry && !entry->occupied) {
-            // Free slot found, key does not exist
-            return -1;
-        }
+#if STASH_UMAP_GROUP_WIDTH == 32
 
-        // Move to the next bucket (linear polling)
-        index = (index + 1) % capacity;
-    } while (index != original_index);
+typedef __m256i u_stash_group;
 
-    // Full table and key not found
-    return -1;
+static inline u_stash_group u_stash_group_load(const uint8_t* ctrl)
+{
+    return _mm256_loadu_si256((const __m256i*)ctrl);
 }
 
-static int u_stash_find_free_slot(const stash_umap* table, uint32_t key)
+static inline uint64_t u_stash_group_match(u_stash_group group, uint8_t h2)
 {
-    if (!stash_umap_is_valid(table) || table->buckets.count == 0) {
-        return -1;
-    }
+    __m256i cmp = _mm256_cmpeq_epi8(group, _mm256_set1_epi8((char)h2));
+    return (uint32_t)_mm256_movemask_epi8(cmp);
+}
 
-    size_t capacity = table->buckets.count;
-    size_t index = u_stash_umap_hash_u32(key, capacity);
-    size_t original_index = index;
+static inline uint64_t u_stash_group_match_empty(u_stash_group group)
+{
+    // Only empty slots have their high bit set
+    return (uint32_t)_mm256_movemask_epi8(group);
+}
 
-    // Searching for the free location using linear probing
-    do {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, index);
-        if (entry) {
-            if (!entry->occupied) {
-                return (int)index;
-            }
-            if (entry->key == key) {
-                // The key already exists
-                return -2;
-            }
-        }
+#elif STASH_UMAP_GROUP_WIDTH == 16
 
-        // Move to the next bucket
-        index = (index + 1) % capacity;
-    } while (index != original_index);
+typedef __m128i u_stash_group;
 
-    // Table pleine
-    return -1;
+static inline u_stash_group u_stash_group_load(const uint8_t* ctrl)
+{
+    return _mm_loadu_si128((const __m128i*)ctrl);
 }
 
-/* === Public Table Implementation === */
+static inline uint64_t u_stash_group_match(u_stash_group group, uint8_t h2)
+{
+    __m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2));
+    return (uint32_t)_mm_movemask_epi8(cmp);
+}
 
-stash_umap stash_umap_create(size_t initialCapacity, size_t value_size)
+static inline uint64_t u_stash_group_match_empty(u_stash_group group)
 {
-    stash_umap table;
-    table.count = 0;
-    table.value_size = value_size;
+    // Only empty slots have their high bit set
+    return (uint32_t)_mm_movemask_epi8(group);
+}
 
-    size_t actual_capacity = initialCapacity > 0 ? initialCapacity : 16;
-    table.buckets = stash_arr_create(actual_capacity, sizeof(stash_umap_entry));
+#else
 
-    if (stash_arr_is_valid(&table.buckets)) {
-        stash_umap_entry default_entry = { 0 };
-        stash_arr_resize(&table.buckets, initialCapacity, &default_entry);
-    }
+typedef uint64_t u_stash_group;
 
-    return table;
-}
+#define U_STASH_GROUP_LSBS 0x0101010101010101ULL
+#define U_STASH_GROUP_MSBS 0x8080808080808080ULL
 
-int stash_umap_reserve(stash_umap* table, size_t newCapacity)
+static inline u_stash_group u_stash_group_load(const uint8_t* ctrl)
 {
-    if (!stash_umap_is_valid(table) || newCapacity < table->count) {
-        return STASH_ERROR_OUT_OF_MEMORY;
-    }
-    stash_arr_reserve(&table->buckets, newCapacity);
-    return STASH_SUCCESS;
+    uint64_t group;
+    memcpy(&group, ctrl, sizeof(group));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    group = __builtin_bswap64(group); //< First slot must be in the low byte
+#endif
+    return group;
 }
 
-void stash_umap_destroy(stash_umap* table)
+static inline uint64_t u_stash_group_match(u_stash_group group, uint8_t h2)
 {
-    if (!stash_umap_is_valid(table)) {
-        return;
-    }
-
-    for (size_t i = 0; i < table->buckets.count; i++) {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at(&table->buckets, i);
-        if (entry && entry->occupied && entry->value) {
-            STASH_FREE(entry->value);
-        }
-    }
-
-    stash_arr_destroy(&table->buckets);
-
-    table->count = 0;
-    table->value_size = 0;
+    // May report false positives next to a real match,
+    // which is harmless since keys are always compared
+    uint64_t x = group ^ (U_STASH_GROUP_LSBS * h2);
+    return (x - U_STASH_GROUP_LSBS) & ~x & U_STASH_GROUP_MSBS;
 }
 
-bool stash_umap_is_valid(const stash_umap* table)
+static inline uint64_t u_stash_group_match_empty(u_stash_group group)
 {
-    return table && stash_arr_is_valid(&table->buckets);
+    // Only empty slots have their high bit set
+    return group & U_STASH_GROUP_MSBS;
 }
 
-bool stash_umap_is_empty(const stash_umap* table)
+#endif
+
+static inline size_t u_stash_bitmask_lowest(uint64_t mask)
 {
-    return !stash_umap_is_valid(table) || table->count == 0;
+    return u_stash_ctz_u64(mask) >> U_STASH_GROUP_SHIFT;
 }
 
-stash_it stash_umap_begin(stash_umap* table)
+/* === Public Hash Implementation === */
+
+static inline uint64_t u_stash_hash_u64(uint64_t h)
 {
-    stash_it it = { 0 };
+    // Murmur3 64-bit finalizer, the low bits select the
+    // bucket and the high bits feed the control byte
 
-    if (!stash_umap_is_valid(table) || table->count == 0) {
-        return it;
-    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
 
-    // Find the first occupied location
-    for (size_t i = 0; i < table->buckets.count; i++) {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, i);
-        if (entry && entry->occupied) {
-            it.curr = entry->value;
+    return h;
+}
 
-            // Store the current index for navigation
-            it.prev = (void*)(uintptr_t)i;
+static inline uint64_t u_stash_hash_bytes(const void* key, size_t size, uint64_t seed)
+{
+    // Folds the key 8 bytes at a time through the 64-bit mixer
 
-            // Find the next occupied element
-            size_t next_idx = i + 1;
-            while (next_idx < table->buckets.count) {
-                stash_umap_entry* nextEntry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, next_idx);
-                if (nextEntry && nextEntry->occupied) {
-                    it.next = nextEntry->value;
-                    break;
-                }
-                next_idx++;
-            }
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint64_t h = seed ^ ((uint64_t)size * 0x9e3779b97f4a7c15ULL);
 
-            // If we haven't found a next one, there isn't one.
-            if (next_idx >= table->buckets.count) {
-                it.next = NULL;
-            }
+    for (; size >= sizeof(uint64_t); bytes += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        h = u_stash_hash_u64(h ^ word);
+    }
 
-            break;
-        }
+    if (size > 0) {
+        uint64_t word = 0;
+        memcpy(&word, bytes, size);
+        h = u_stash_hash_u64(h ^ word);
     }
 
-    return it;
+    return h;
 }
 
-void stash_umap_previous(stash_umap* table, stash_it* it)
+static inline uint64_t u_stash_hash_fold(const void* key, size_t size)
 {
-    if (!stash_umap_is_valid(table) || !it || table->count == 0) {
-        return;
+    // The key itself up to 8 bytes, longer keys fold their 8-byte words (zero padded) with a
+    // multiply and a rotation each, so that swapped or repeated words do not cancel out
+
+    const uint8_t* bytes = (const uint8_t*)key;
+    uint64_t h = 0;
+
+    if (size <= sizeof(uint64_t)) {
+        memcpy(&h, bytes, size);
+        return h;
     }
 
-    // If we are already at the beginning or before
-    if (it->curr == NULL) {
-        // If next is set, we are just before the start
-        if (it->next != NULL) {
-            // We stay before the start
-            return;
-        }
+    while (size > 0) {
+        size_t n = (size < sizeof(uint64_t)) ? size : sizeof(uint64_t);
+        uint64_t word = 0;
+        memcpy(&word, bytes, n);
 
-        // Otherwise we go to the end
-        *it = stash_umap_end(table);
-        return;
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h = (h << 31) | (h >> 33);
+
+        bytes += n;
+        size -= n;
     }
 
-    // Retrieve the current index
-    size_t curr_idx = (size_t)(uintptr_t)it->prev;
+    return h;
+}
 
-    // Find the previous occupied element
-    size_t prev_idx = curr_idx;
-    if (prev_idx > 0) {
-        prev_idx--;
+uint64_t stash_hash_mix(const void* key, size_t size, uint64_t seed)
+{
+    if (size == sizeof(uint32_t)) {
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+        return u_stash_hash_u64(k ^ seed);
+    }
 
-        while (prev_idx > 0) {
-            stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, prev_idx);
-            if (entry && entry->occupied) {
-                break;
-            }
-            prev_idx--;
-        }
+    return u_stash_hash_bytes(key, size, seed);
+}
 
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, prev_idx);
-        if (entry && entry->occupied) {
-            // Save the current pointer
-            void* oldCurr = it->curr;
+uint64_t stash_hash_identity(const void* key, size_t size, uint64_t seed)
+{
+    (void)seed;
 
-            // Update the iterator
-            it->curr = entry->value;
-            it->next = oldCurr;
-            it->prev = (void*)(uintptr_t)prev_idx;
-        }
-        else {
-            // We are before the beginning
-            it->next = it->curr;
-            it->curr = NULL;
-            it->prev = NULL;
-        }
+    if (size == sizeof(uint32_t)) {
+        // Copied in the upper half too, so the control bytes see some key bits
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+        return (uint64_t)k | ((uint64_t)k << 32);
+    }
+
+    return u_stash_hash_fold(key, size);
+}
+
+uint64_t stash_hash_fibonacci(const void* key, size_t size, uint64_t seed)
+{
+    uint64_t h;
+
+    if (size == sizeof(uint32_t)) {
+        uint32_t k;
+        memcpy(&k, key, sizeof(k));
+        h = k;
     }
     else {
-        // We are before the beginning
-        it->next = it->curr;
-        it->curr = NULL;
-        it->prev = NULL;
+        h = u_stash_hash_fold(key, size);
     }
+
+    // The best mixed bits of the product are the high ones, fold them onto the bucket bits
+    h = (h ^ seed) * 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
 }
 
-void stash_umap_next(stash_umap* table, stash_it* it)
+/* === Private Table Implementation === */
+
+static inline uint64_t u_stash_umap_hash(const stash_umap* table, const void* key)
 {
-    if (!stash_umap_is_valid(table) || !it || table->count == 0) {
-        return;
+    // The compile-time default is called directly so that it can be inlined
+    if (table->hash == STASH_UMAP_HASH) {
+        return STASH_UMAP_HASH(key, table->key_size, table->seed);
     }
 
-    // If we are already at the end or after
-    if (it->curr == NULL) {
-        // If prev is set, we are just after the end
-        if (it->prev != NULL) {
-            // We stay after the end
-            return;
-        }
+    return table->hash(key, table->key_size, table->seed);
+}
 
-        // Otherwise, we go to the beginning
-        *it = stash_umap_begin(table);
-        return;
+static inline bool u_stash_umap_key_eq(const stash_umap* table, const void* a, const void* b)
+{
+    if (table->key_size == sizeof(uint32_t)) {
+        uint32_t x, y;
+        memcpy(&x, a, sizeof(x));
+        memcpy(&y, b, sizeof(y));
+        return x == y;
     }
 
-    // If next is NULL, we are at the end
-    if (it->next == NULL) {
-        // Save current pointer to prev (to allow going back)
-        void* oldCurr = it->curr;
-        it->prev = oldCurr;
-        it->curr = NULL;
-        return;
+    // Wider keys are compared 8 bytes at a time, the tail (if any) with memcmp
+
+    const uint8_t* x = (const uint8_t*)a;
+    const uint8_t* y = (const uint8_t*)b;
+    size_t size = table->key_size;
+    uint64_t diff = 0;
+
+    for (; size >= sizeof(uint64_t); x += sizeof(uint64_t), y += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+        uint64_t wx, wy;
+        memcpy(&wx, x, sizeof(wx));
+        memcpy(&wy, y, sizeof(wy));
+        diff |= wx ^ wy;
     }
 
-    // Retrieve the current index
-    size_t curr_idx = (size_t)(uintptr_t)it->prev;
+    return diff == 0 && (size == 0 || memcmp(x, y, size) == 0);
+}
 
-    // Find the next occupied element
-    size_t next_idx = curr_idx + 1;
-    while (next_idx < table->buckets.count) {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, next_idx);
-        if (entry && entry->occupied) {
-            break;
-        }
-        next_idx++;
+static size_t u_stash_umap_slot_layout(size_t key_size, size_t value_size, size_t* value_offset)
+{
+    // Keys are aligned on the largest power of two dividing their size (up to 8)
+    size_t key_align = key_size & (~key_size + 1);
+    if (key_align > sizeof(uint64_t)) key_align = sizeof(uint64_t);
+
+    // Key-only slots (sets) are not padded for a value
+    if (value_size == 0) {
+        *value_offset = key_size;
+        return key_size;
     }
 
-    if (next_idx < table->buckets.count) {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, next_idx);
+    // Values are stored right after the key, aligned on the
+    // largest power of two dividing their size (up to STASH_MAX_ALIGN)
+    size_t align = value_size & (~value_size + 1);
+    if (align == 0 || align > STASH_MAX_ALIGN) align = STASH_MAX_ALIGN;
 
-        // Update the iterator
-        it->curr = entry->value;
-        it->prev = (void*)(uintptr_t)next_idx;
+    *value_offset = (key_size + align - 1) & ~(align - 1);
 
-        // Find the next occupied element
-        size_t next_next_idx = next_idx + 1;
-        while (next_next_idx < table->buckets.count) {
-            stash_umap_entry* nextEntry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, next_next_idx);
-            if (nextEntry && nextEntry->occupied) {
-                it->next = nextEntry->value;
-                break;
-            }
-            next_next_idx++;
-        }
+    if (align < key_align) align = key_align; //< Keeps the keys aligned
+    return (*value_offset + value_size + align - 1) & ~(align - 1);
+}
 
-        // If we haven't found a next one, there isn't one
-        if (next_next_idx >= table->buckets.count) {
-            it->next = NULL;
-        }
-    }
-    else {
-        // We are at the end
-        void* oldCurr = it->curr;
-        it->prev = oldCurr;
-        it->curr = NULL;
-        it->next = NULL;
+static inline uint8_t u_stash_umap_h2(uint64_t hash)
+{
+    // 7 bits of hash stored in the control byte of full slots
+    return (uint8_t)(hash >> 57);
+}
+
+static inline void* u_stash_umap_key_at(const stash_umap* table, size_t index)
+{
+    // Keys always sit at the start of a slot
+    return (char*)table->buckets.data + index * table->buckets.elem_size;
+}
+
+static inline size_t u_stash_umap_index_offset(const stash_umap* table)
+{
+    // Ordered buckets hold the key followed by the uint32_t index of its dense entry
+    return (table->key_size + sizeof(uint32_t) - 1) & ~(sizeof(uint32_t) - 1);
+}
+
+static inline size_t u_stash_umap_entry_index(const stash_umap* table, size_t index)
+{
+    uint32_t entry;
+    memcpy(&entry, (char*)u_stash_umap_key_at(table, index) + u_stash_umap_index_offset(table), sizeof(entry));
+    return entry;
+}
+
+static inline void* u_stash_umap_entry_value(const stash_umap* table, size_t entry)
+{
+    return (char*)table->entries.data + entry * table->entries.elem_size + table->value_offset;
+}
+
+static inline void* u_stash_umap_value_at(const stash_umap* table, size_t index)
+{
+    if (table->values.data != NULL) {
+        return (char*)table->values.data + index * table->values.elem_size;
     }
+    if (table->entries.data != NULL) {
+        return u_stash_umap_entry_value(table, u_stash_umap_entry_index(table, index));
+    }
+    return (char*)u_stash_umap_key_at(table, index) + table->value_offset;
 }
 
-stash_it stash_umap_end(stash_umap* table)
+static inline void u_stash_umap_copy_slot(stash_umap* dst, size_t dst_index, const stash_umap* src, size_t src_index)
 {
-    stash_it it = { 0 };
+    memcpy(u_stash_umap_key_at(dst, dst_index), u_stash_umap_key_at(src, src_index), dst->buckets.elem_size);
+    if (dst->values.data != NULL) {
+        memcpy(u_stash_umap_value_at(dst, dst_index), u_stash_umap_value_at(src, src_index), dst->value_size);
+    }
+}
+
+static inline bool u_stash_umap_is_full(const stash_umap* table, size_t index)
+{
+    return !(((const uint8_t*)table->ctrl.data)[index] & U_STASH_CTRL_EMPTY);
+}
+
+static inline void u_stash_umap_set_ctrl(stash_umap* table, size_t index, uint8_t ctrl)
+{
+    uint8_t* bytes = (uint8_t*)table->ctrl.data;
+    bytes[index] = ctrl;
+
+    // The first bytes are mirrored after the end so that groups can wrap around
+    if (index < STASH_UMAP_GROUP_WIDTH - 1) {
+        bytes[table->buckets.count + index] = ctrl;
+    }
+}
+
+static int u_stash_umap_alloc_buckets(stash_umap* table, size_t bucket_count, size_t stride)
+{
+    bool split = (table->flags & STASH_UMAP_SPLIT) && table->value_size > 0;
+
+    stash_arr buckets = stash_arr_create(bucket_count, stride);
+    stash_arr values = split ? stash_arr_create(bucket_count, table->value_size) : (stash_arr) { 0 };
+    stash_arr ctrl = stash_arr_create(bucket_count + STASH_UMAP_GROUP_WIDTH - 1, sizeof(uint8_t));
+    stash_arr dists = stash_arr_create(bucket_count, sizeof(uint8_t));
+
+    if (!stash_arr_is_valid(&buckets) || !stash_arr_is_valid(&ctrl) || !stash_arr_is_valid(&dists)
+        || (split && !stash_arr_is_valid(&values))) {
+        stash_arr_destroy(&buckets);
+        stash_arr_destroy(&values);
+        stash_arr_destroy(&ctrl);
+        stash_arr_destroy(&dists);
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    buckets.count = bucket_count;
+    values.count = split ? bucket_count : 0;
+    dists.count = bucket_count;
+    ctrl.count = ctrl.capacity;
+    memset(ctrl.data, U_STASH_CTRL_EMPTY, ctrl.count);
+
+    table->buckets = buckets;
+    table->values = values;
+    table->ctrl = ctrl;
+    table->dists = dists;
+
+    return STASH_SUCCESS;
+}
 
+static int64_t u_stash_find_entry_index(const stash_umap* table, const void* key, uint64_t hash)
+{
     if (!stash_umap_is_valid(table) || table->count == 0) {
-        return it;
+        return -1;
     }
 
-    // Find the last occupied location
-    int64_t i = table->buckets.count - 1;
-    while (i >= 0) {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, (size_t)i);
-        if (entry && entry->occupied) {
-            it.curr = entry->value;
-            it.prev = (void*)(uintptr_t)i;
+    const uint8_t* ctrl = (const uint8_t*)table->ctrl.data;
+    const uint8_t* dists = (const uint8_t*)table->dists.data;
+    size_t mask = table->buckets.count - 1;
 
-            // For consistency with the rest of the API
-            // next is NULL for the last element
-            it.next = NULL;
-            break;
+    uint8_t h2 = u_stash_umap_h2(hash);
+    size_t home = hash & mask;
+    size_t pos = home;
+
+    // Linear probing, one group of control bytes at a time
+    for (;;) {
+        u_stash_group group = u_stash_group_load(ctrl + pos);
+        U_STASH_UMAP_STAT(table, probe_steps, 1);
+
+        for (uint64_t match = u_stash_group_match(group, h2); match; match &= match - 1) {
+            size_t index = (pos + u_stash_bitmask_lowest(match)) & mask;
+            if (u_stash_umap_key_eq(table, u_stash_umap_key_at(table, index), key)) {
+                return (int64_t)index;
+            }
         }
-        i--;
+
+        // Free slot found, key does not exist
+        // NOTE: The table always keeps at least one free slot
+        if (u_stash_group_match_empty(group)) {
+            return -1;
+        }
+
+        // Robin Hood invariant: if the last slot of the group is closer to its
+        // home than we are from ours, the key cannot be stored any further
+        size_t last = (pos + STASH_UMAP_GROUP_WIDTH - 1) & mask;
+        if (dists[last] < u_stash_umap_dist_cap((last - home) & mask)) {
+            return -1;
+        }
+
+        pos = (pos + STASH_UMAP_GROUP_WIDTH) & mask;
+    }
+}
+
+static size_t u_stash_umap_dist_at(const stash_umap* table, size_t index)
+{
+    // Saturated distances are recovered from the home of the key, only colliding hashes get there
+    size_t dist = ((const uint8_t*)table->dists.data)[index];
+    if (dist < U_STASH_DIST_MAX) {
+        return dist;
     }
 
-    return it;
+    size_t home = u_stash_umap_hash(table, u_stash_umap_key_at(table, index)) & (table->buckets.count - 1);
+    return (index - home) & (table->buckets.count - 1);
 }
 
-int stash_umap_insert(stash_umap* table, uint32_t key, const void* value)
+static inline bool u_stash_umap_is_richer(const stash_umap* table, size_t index, size_t dist)
 {
-    if (!stash_umap_is_valid(table) || !value) {
-        return STASH_ERROR_OUT_OF_MEMORY;
+    // Whether the entry at 'index' is closer to its home than 'dist', the Robin Hood insertion point
+    const uint8_t* dists = (const uint8_t*)table->dists.data;
+    if (dists[index] < U_STASH_DIST_MAX || dist <= U_STASH_DIST_MAX) {
+        return dists[index] < dist;
+    }
+
+    return u_stash_umap_dist_at(table, index) < dist;
+}
+
+static int64_t u_stash_umap_probe(const stash_umap* table, const void* key, uint64_t hash, size_t* pos, size_t* dist)
+{
+    const uint8_t* ctrl = (const uint8_t*)table->ctrl.data;
+    size_t mask = table->buckets.count - 1;
+
+    uint8_t h2 = u_stash_umap_h2(hash);
+    size_t index = hash & mask;
+
+    // Walk the run until the key or the Robin Hood insertion point is found
+    for (size_t d = 0;; d++, index = (index + 1) & mask) {
+        if ((ctrl[index] & U_STASH_CTRL_EMPTY) || u_stash_umap_is_richer(table, index, d)) {
+            *pos = index;
+            *dist = d;
+            return -1;
+        }
+        if (ctrl[index] == h2 && u_stash_umap_key_eq(table, u_stash_umap_key_at(table, index), key)) {
+            return (int64_t)index;
+        }
     }
+}
 
-    // Check if the table needs to be resized
-    if (table->buckets.count + 1 >= table->buckets.capacity) {
-        size_t newSize = u_stash_next_po2_u64(table->buckets.count + 1);
-        stash_arr_reserve(&table->buckets, newSize);
+static void u_stash_umap_probe_slot(const stash_umap* table, uint64_t hash, size_t* pos, size_t* dist)
+{
+    // Robin Hood insertion point of a key known to be absent, no key is compared
+    const uint8_t* ctrl = (const uint8_t*)table->ctrl.data;
+    size_t mask = table->buckets.count - 1;
+    size_t index = hash & mask;
+
+    for (size_t d = 0;; d++, index = (index + 1) & mask) {
+        if ((ctrl[index] & U_STASH_CTRL_EMPTY) || u_stash_umap_is_richer(table, index, d)) {
+            *pos = index;
+            *dist = d;
+            return;
+        }
     }
+}
 
-    // Find a free location
-    int slot_index = u_stash_find_free_slot(table, key);
-    if (slot_index == -2) {
-        return STASH_KEY_EXISTS; // The key already exists
+static void u_stash_umap_make_room(stash_umap* table, size_t pos, size_t dist)
+{
+    uint8_t* ctrl = (uint8_t*)table->ctrl.data;
+    uint8_t* dists = (uint8_t*)table->dists.data;
+    size_t mask = table->buckets.count - 1;
+
+    // Find the end of the run, every shifted entry gets one step further from its home
+    size_t end = pos;
+    while (!(ctrl[end] & U_STASH_CTRL_EMPTY)) {
+        end = (end + 1) & mask;
     }
-    else if (slot_index == -1) {
-        return STASH_ERROR_OUT_OF_MEMORY; // Table is full
+
+    // Shift the run one slot to the right, no tombstones are ever left behind
+    while (end != pos) {
+        size_t prev = (end - 1) & mask;
+        u_stash_umap_copy_slot(table, end, table, prev);
+        u_stash_umap_set_ctrl(table, end, ctrl[prev]);
+        dists[end] = (uint8_t)u_stash_umap_dist_cap((size_t)dists[prev] + 1);
+        end = prev;
     }
 
-    // Allocate memory for the value
-    void* value_copy = STASH_MALLOC(table->value_size);
-    if (!value_copy) {
-        return STASH_ERROR_OUT_OF_MEMORY;
+    dists[pos] = (uint8_t)u_stash_umap_dist_cap(dist);
+}
+
+static void u_stash_umap_erase_at(stash_umap* table, size_t index)
+{
+    uint8_t* ctrl = (uint8_t*)table->ctrl.data;
+    uint8_t* dists = (uint8_t*)table->dists.data;
+    size_t mask = table->buckets.count - 1;
+
+    // Backward shift deletion, pull back the following entries of
+    // the run until an empty slot or an entry at its home is reached
+    size_t hole = index;
+    size_t next = (hole + 1) & mask;
+
+    while (!(ctrl[next] & U_STASH_CTRL_EMPTY) && dists[next] > 0) {
+        size_t dist = u_stash_umap_dist_at(table, next);
+
+        u_stash_umap_copy_slot(table, hole, table, next);
+        u_stash_umap_set_ctrl(table, hole, ctrl[next]);
+        dists[hole] = (uint8_t)u_stash_umap_dist_cap(dist - 1);
+        hole = next;
+        next = (next + 1) & mask;
     }
 
-    // Copy value
-    memcpy(value_copy, value, table->value_size);
+    u_stash_umap_set_ctrl(table, hole, U_STASH_CTRL_EMPTY);
+}
 
-    // Get the entry and update it
-    stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at(&table->buckets, slot_index);
-    entry->key = key;
-    entry->occupied = true;
-    entry->value = value_copy;
+static inline size_t u_stash_umap_buckets_for(const stash_umap* table, size_t count)
+{
+    // Smallest power of two bucket count able to hold 'count' elements under the max load factor
+    size_t min_count = (size_t)((double)count / table->max_load_factor) + 1;
+    return (size_t)u_stash_ceil_po2_u64((int64_t)min_count);
+}
 
-    table->count++;
+static inline void u_stash_umap_update_growth_limit(stash_umap* table)
+{
+    if (table->flags & STASH_UMAP_SMALL) {
+        table->growth_limit = STASH_UMAP_SMALL_SIZE;
+        return;
+    }
+
+    table->growth_limit = (size_t)((double)table->buckets.count * table->max_load_factor);
+    if (table->growth_limit >= table->buckets.count) {
+        table->growth_limit = table->buckets.count - 1; //< Always keep a free slot
+    }
+}
+
+static inline void u_stash_umap_free_buckets(stash_umap* table)
+{
+    stash_arr_destroy(&table->buckets);
+    stash_arr_destroy(&table->values);
+    stash_arr_destroy(&table->ctrl);
+    stash_arr_destroy(&table->dists);
+}
+
+static inline size_t u_stash_umap_live_count(const stash_umap* table)
+{
+    // Number of elements stored in the current bucket array
+    return table->old ? table->count - table->old->count : table->count;
+}
+
+static inline int64_t u_stash_umap_small_find(const stash_umap* table, const void* key)
+{
+    // Small tables compare the key against all their keys at once, no hashing involved
+
+    uint32_t needle;
+    memcpy(&needle, key, sizeof(needle));
+
+    const uint32_t* keys = table->small_keys;
+    uint64_t match = 0;
+
+#if STASH_UMAP_GROUP_WIDTH == 32
+    __m256i broadcast = _mm256_set1_epi32((int)needle);
+    for (size_t i = 0; i < STASH_UMAP_SMALL_SIZE; i += 8) {
+        __m256i lanes = _mm256_loadu_si256((const __m256i*)(keys + i));
+        match |= (uint64_t)(uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(lanes, broadcast))) << i;
+    }
+#elif STASH_UMAP_GROUP_WIDTH == 16
+    __m128i broadcast = _mm_set1_epi32((int)needle);
+    for (size_t i = 0; i < STASH_UMAP_SMALL_SIZE; i += 4) {
+        __m128i lanes = _mm_loadu_si128((const __m128i*)(keys + i));
+        match |= (uint64_t)(uint32_t)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lanes, broadcast))) << i;
+    }
+#else
+    for (size_t i = 0; i < STASH_UMAP_SMALL_SIZE; i++) {
+        match |= (uint64_t)(keys[i] == needle) << i;
+    }
+#endif
+
+    // Lanes past the count hold stale keys
+    match &= ((uint64_t)1 << table->count) - 1;
+
+    return match ? (int64_t)u_stash_ctz_u64(match) : -1;
+}
+
+static void u_stash_umap_small_erase(stash_umap* table, size_t index)
+{
+    // The following entries move down by one, which keeps the insertion order
+    size_t tail = table->count - 1 - index;
+    char* values = (char*)table->values.data;
+
+    memmove(&table->small_keys[index], &table->small_keys[index + 1], tail * sizeof(uint32_t));
+    memmove(values + index * table->value_size, values + (index + 1) * table->value_size, tail * table->value_size);
+}
+
+static int u_stash_umap_small_promote(stash_umap* table, size_t bucket_count)
+{
+    // The inline keys and their values move to a regular bucket array
+
+    stash_umap small = *table;
+    table->flags &= ~(uint32_t)STASH_UMAP_SMALL;
+
+    int ret = u_stash_umap_alloc_buckets(table, bucket_count, small.buckets.elem_size);
+    if (ret < 0) {
+        table->flags = small.flags;
+        return ret;
+    }
+
+    u_stash_umap_update_growth_limit(table);
+
+    for (size_t i = 0; i < small.count; i++) {
+        const void* key = &small.small_keys[i];
+        uint64_t hash = u_stash_umap_hash(table, key);
+
+        size_t pos, dist;
+        u_stash_umap_probe_slot(table, hash, &pos, &dist);
+        u_stash_umap_make_room(table, pos, dist);
+
+        memcpy(u_stash_umap_key_at(table, pos), key, sizeof(uint32_t));
+        u_stash_umap_set_ctrl(table, pos, u_stash_umap_h2(hash));
+        memcpy(u_stash_umap_value_at(table, pos), u_stash_umap_value_at(&small, i), table->value_size);
+    }
+
+    stash_arr_destroy(&small.values);
 
     return STASH_SUCCESS;
 }
 
-int stash_umap_remove(stash_umap* table, uint32_t key, void* element)
+static int u_stash_umap_rebuild(stash_umap* table, size_t bucket_count)
 {
-    if (!stash_umap_is_valid(table)) {
-        return STASH_ERROR_KEY_NOT_FOUND;
+    if (table->mapping != NULL) {
+        return STASH_ERROR_OUT_OF_BOUNDS; //< Mapped tables are read-only
     }
 
-    int64_t index = u_stash_find_entry_index(table, key);
-    if (index < 0) {
-        return STASH_ERROR_KEY_NOT_FOUND;
+    // Never go below what the current elements require
+    size_t min_count = u_stash_umap_buckets_for(table, u_stash_umap_live_count(table));
+    if (bucket_count < min_count) bucket_count = min_count;
+
+    bucket_count = (size_t)u_stash_ceil_po2_u64((int64_t)bucket_count);
+    if (bucket_count < STASH_UMAP_GROUP_WIDTH) bucket_count = STASH_UMAP_GROUP_WIDTH;
+
+    if (table->flags & STASH_UMAP_SMALL) {
+        return u_stash_umap_small_promote(table, bucket_count);
     }
 
-    stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at(&table->buckets, (uint32_t)index);
+    stash_umap prev = *table;
 
-    // Copy the value if requested
-    if (element != NULL) {
-        memcpy(element, entry->value, table->value_size);
+    int ret = u_stash_umap_alloc_buckets(table, bucket_count, prev.buckets.elem_size);
+    if (ret < 0) return ret;
+
+    u_stash_umap_update_growth_limit(table);
+
+    // Reinsert every live entry, keys are known to be unique
+    for (size_t i = 0; i < prev.buckets.count; i++) {
+        if (!u_stash_umap_is_full(&prev, i)) continue;
+
+        const void* key = u_stash_umap_key_at(&prev, i);
+        uint64_t hash = u_stash_umap_hash(table, key);
+
+        size_t pos, dist;
+        u_stash_umap_probe_slot(table, hash, &pos, &dist);
+        u_stash_umap_make_room(table, pos, dist);
+
+        u_stash_umap_copy_slot(table, pos, &prev, i);
+        u_stash_umap_set_ctrl(table, pos, u_stash_umap_h2(hash));
     }
 
-    // Free the value memory
-    STASH_FREE(entry->value);
+    u_stash_umap_free_buckets(&prev);
+
+    return STASH_SUCCESS;
+}
+
+static int64_t u_stash_umap_lookup_hashed(const stash_umap* table, const void* key, uint64_t hash, const stash_umap** owner)
+{
+    int64_t index;
+    *owner = table;
 
-    // Mark the entry as free
-    entry->occupied = false;
-    entry->value = NULL;
+    if (table->flags & STASH_UMAP_SMALL) {
+        // A single compare against every key, counted as one probe step
+        index = u_stash_umap_small_find(table, key);
+        U_STASH_UMAP_STAT(table, probe_steps, 1);
+    }
+    else {
+        // While migrating, an entry lives in either the current or the old bucket array
+        index = u_stash_find_entry_index(table, key, hash);
 
-    table->count--;
+        if (index < 0 && table->old != NULL) {
+            index = u_stash_find_entry_index(table->old, key, hash);
+            *owner = table->old;
+        }
+    }
+
+    U_STASH_UMAP_STAT(table, lookups, 1);
+    U_STASH_UMAP_STAT(table, misses, index < 0);
+
+    return index;
+}
+
+static inline int64_t u_stash_umap_lookup(const stash_umap* table, const void* key, const stash_umap** owner)
+{
+    // Small tables never hash their keys
+    uint64_t hash = (table->flags & STASH_UMAP_SMALL) ? 0 : u_stash_umap_hash(table, key);
+
+    return u_stash_umap_lookup_hashed(table, key, hash, owner);
+}
+
+static inline void u_stash_umap_prefetch(const stash_umap* table, uint64_t hash)
+{
+    if (table->flags & STASH_UMAP_SMALL) {
+        return; //< Small tables sit in the struct itself
+    }
+
+    // Bring the home group and the home slot in cache ahead of the probe
+    size_t home = hash & (table->buckets.count - 1);
+    U_STASH_PREFETCH((const uint8_t*)table->ctrl.data + home);
+    U_STASH_PREFETCH(u_stash_umap_key_at(table, home));
+    if (table->values.data != NULL) {
+        U_STASH_PREFETCH(u_stash_umap_value_at(table, home));
+    }
+}
+
+static int u_stash_umap_migrate_entry(stash_umap* table, size_t index)
+{
+    stash_umap* old = table->old;
+
+    const void* key = u_stash_umap_key_at(old, index);
+    uint64_t hash = u_stash_umap_hash(table, key);
+
+    size_t pos, dist;
+    u_stash_umap_probe_slot(table, hash, &pos, &dist);
+    u_stash_umap_make_room(table, pos, dist);
+
+    u_stash_umap_copy_slot(table, pos, old, index);
+    u_stash_umap_set_ctrl(table, pos, u_stash_umap_h2(hash));
+
+    // Removing it from the old array keeps its probe sequences valid
+    u_stash_umap_erase_at(old, index);
+    old->count--;
 
     return STASH_SUCCESS;
 }
 
-int stash_umap_get(const stash_umap* table, uint32_t key, void* element)
+static void u_stash_umap_free_old(stash_umap* table)
 {
-    if (!stash_umap_is_valid(table) || !element) {
-        return STASH_ERROR_KEY_NOT_FOUND;
+    // Probe steps done in the old array are kept by the table
+    U_STASH_UMAP_STAT(table, probe_steps, table->old->probe_steps);
+
+    u_stash_umap_free_buckets(table->old);
+    STASH_FREE(table->old);
+    table->old = NULL;
+    table->migrate_pos = 0;
+}
+
+static int u_stash_umap_migrate(stash_umap* table, size_t steps)
+{
+    stash_umap* old = table->old;
+    if (old == NULL) {
+        return STASH_SUCCESS;
     }
 
-    int64_t index = u_stash_find_entry_index(table, key);
-    if (index < 0) {
-        return STASH_ERROR_KEY_NOT_FOUND;
+    // Each step moves one entry or skips one empty slot of the old array
+    while (steps > 0 && old->count > 0 && table->migrate_pos < old->buckets.count) {
+        if (u_stash_umap_is_full(old, table->migrate_pos)) {
+            // The backward shift can pull another entry in this slot, so we stay on it
+            int ret = u_stash_umap_migrate_entry(table, table->migrate_pos);
+            if (ret < 0) return ret;
+        }
+        else {
+            table->migrate_pos++;
+        }
+        steps--;
     }
 
-    stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at((stash_arr*)&table->buckets, (uint32_t)index);
-    memcpy(element, entry->value, table->value_size);
+    if (old->count == 0) {
+        u_stash_umap_free_old(table);
+    }
 
     return STASH_SUCCESS;
 }
 
-bool stash_umap_contains(const stash_umap* table, uint32_t key)
+static int u_stash_umap_finish_migration(stash_umap* table)
 {
-    if (!stash_umap_is_valid(table)) return false;
-    return u_stash_find_entry_index(table, key) >= 0;
+    if (table->old == NULL) {
+        return STASH_SUCCESS;
+    }
+
+    // Make sure the current bucket array can take all the remaining entries
+    if (table->count > table->growth_limit) {
+        int ret = u_stash_umap_rebuild(table, u_stash_umap_buckets_for(table, table->count));
+        if (ret < 0) return ret;
+    }
+
+    return u_stash_umap_migrate(table, SIZE_MAX);
 }
 
-void stash_umap_clear(stash_umap* table)
+static int u_stash_umap_start_migration(stash_umap* table, size_t bucket_count)
 {
-    if (!stash_umap_is_valid(table)) {
-        return;
+    stash_umap* old = (stash_umap*)STASH_MALLOC(sizeof(stash_umap));
+    if (old == NULL) {
+        return STASH_ERROR_OUT_OF_MEMORY;
     }
 
-    for (size_t i = 0; i < table->buckets.count; i++) {
-        stash_umap_entry* entry = (stash_umap_entry*)stash_arr_at(&table->buckets, i);
-        if (entry && entry->occupied) {
-            if (entry->value) {
-                STASH_FREE(entry->value);
-                entry->value = NULL;
-            }
-            entry->occupied = false;
+    *old = *table;
+
+#ifdef STASH_STATS
+    old->probe_steps = 0; //< Added back to the table by u_stash_umap_free_old()
+#endif
+
+    int ret = u_stash_umap_alloc_buckets(table, bucket_count, old->buckets.elem_size);
+    if (ret < 0) {
+        STASH_FREE(old);
+        return ret;
+    }
+
+    u_stash_umap_update_growth_limit(table);
+
+    table->old = old;
+    table->migrate_pos = 0;
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_umap_grow(stash_umap* table)
+{
+    size_t bucket_count = table->buckets.count * 2;
+
+    if (!(table->flags & STASH_UMAP_INCREMENTAL)) {
+        return u_stash_umap_rebuild(table, bucket_count);
+    }
+
+    // Only one migration at a time, complete the pending one first
+    if (table->old != NULL) {
+        int ret = u_stash_umap_finish_migration(table);
+        if (ret < 0) return ret;
+
+        if (table->count + 1 <= table->growth_limit) {
+            return STASH_SUCCESS;
         }
+
+        bucket_count = table->buckets.count * 2;
     }
 
-    table->count = 0;
+    // The old bucket array is moved to the new one a few entries per operation
+    return u_stash_umap_start_migration(table, bucket_count);
 }
 
-size_t stash_umap_count(const stash_umap* table)
+static int u_stash_umap_reserve_entry(stash_umap* table)
 {
-    return stash_umap_is_valid(table) ? table->count : 0;
+    if (table->entries.count < table->entries.capacity) {
+        return STASH_SUCCESS;
+    }
+
+    if (table->entries.count >= UINT32_MAX) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    size_t capacity = (size_t)u_stash_next_po2_u64((int64_t)table->entries.count);
+
+    int ret = stash_arr_reserve(&table->entries, capacity);
+    if (ret < 0) return ret;
+
+    return stash_arr_reserve(&table->live, capacity);
+}
+
+static void u_stash_umap_push_entry(stash_umap* table, size_t index, const void* key)
+{
+    // Appends the dense entry of the key just placed at 'index', capacity is already reserved
+
+    uint32_t entry = (uint32_t)table->entries.count;
+
+    memcpy((char*)table->entries.data + entry * table->entries.elem_size, key, table->key_size);
+    memcpy((char*)u_stash_umap_key_at(table, index) + u_stash_umap_index_offset(table), &entry, sizeof(entry));
+    ((uint8_t*)table->live.data)[entry] = 1;
+
+    table->entries.count++;
+    table->live.count++;
+}
+
+static int u_stash_umap_compact_entries(stash_umap* table)
+{
+    // Packs the live entries to the front, keeping their order, then fixes the bucket indices
+
+    uint32_t* remap = (uint32_t*)STASH_MALLOC(table->entries.count * sizeof(uint32_t));
+    if (remap == NULL) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    uint8_t* live = (uint8_t*)table->live.data;
+    size_t stride = table->entries.elem_size;
+    size_t count = 0;
+
+    for (size_t i = 0; i < table->entries.count; i++) {
+        if (!live[i]) continue;
+        if (count != i) {
+            memcpy((char*)table->entries.data + count * stride, (char*)table->entries.data + i * stride, stride);
+            live[count] = 1;
+        }
+        remap[i] = (uint32_t)count++;
+    }
+
+    for (size_t i = 0; i < table->buckets.count; i++) {
+        if (!u_stash_umap_is_full(table, i)) continue;
+        uint32_t entry = remap[u_stash_umap_entry_index(table, i)];
+        memcpy((char*)u_stash_umap_key_at(table, i) + u_stash_umap_index_offset(table), &entry, sizeof(entry));
+    }
+
+    STASH_FREE(remap);
+
+    table->entries.count = count;
+    table->live.count = count;
+    table->tombstones = 0;
+
+    return STASH_SUCCESS;
 }
 
+static inline size_t u_stash_umap_iter_count(const stash_umap* table)
+{
+    // Ordered tables are walked over their dense entries, small ones over their
+    // inline keys, others over their buckets
+    if (table->flags & STASH_UMAP_SMALL) return table->count;
+    return (table->entries.data != NULL) ? table->entries.count : table->buckets.count;
+}
+
+static inline bool u_stash_umap_iter_full(const stash_umap* table, size_t index)
+{
+    if (table->flags & STASH_UMAP_SMALL) {
+        return true;
+    }
+    if (table->entries.data != NULL) {
+        return ((const uint8_t*)table->live.data)[index] != 0;
+    }
+    return u_stash_umap_is_full(table, index);
+}
+
+static inline void* u_stash_umap_iter_value(const stash_umap* table, size_t index)
+{
+    if (table->entries.data != NULL) {
+        return u_stash_umap_entry_value(table, index);
+    }
+    return u_stash_umap_value_at(table, index);
+}
+
+static int u_stash_umap_emplace(stash_umap* table, const void* key, void** value)
+{
+    if (table->mapping != NULL) {
+        return STASH_ERROR_OUT_OF_BOUNDS; //< Mapped tables are read-only
+    }
+
+    if (table->flags & STASH_UMAP_SMALL) {
+        int64_t index = u_stash_umap_small_find(table, key);
+        if (index >= 0) {
+            *value = u_stash_umap_value_at(table, (size_t)index);
+            return STASH_KEY_EXISTS;
+        }
+
+        if (table->count < STASH_UMAP_SMALL_SIZE) {
+            memcpy(&table->small_keys[table->count], key, sizeof(uint32_t));
+            *value = u_stash_umap_value_at(table, table->count);
+            table->count++;
+            return STASH_SUCCESS;
+        }
+
+        // No room left inline, switch to a bucket array
+        int ret = u_stash_umap_rebuild(table, u_stash_umap_buckets_for(table, table->count + 1));
+        if (ret < 0) return ret;
+    }
+
+    // Move a few entries if an incremental rehash is in progress
+    if (table->old != NULL) {
+        int ret = u_stash_umap_migrate(table, STASH_UMAP_MIGRATE_STEP);
+        if (ret < 0) return ret;
+    }
+
+    uint64_t hash = u_stash_umap_hash(table, key);
+
+    // Find the key or its Robin Hood insertion point
+    size_t pos = 0, dist = 0;
+    int64_t index = u_stash_umap_probe(table, key, hash, &pos, &dist);
+    if (index >= 0) {
+        *value = u_stash_umap_value_at(table, (size_t)index);
+        return STASH_KEY_EXISTS;
+    }
+
+    // The key may still be in the old bucket array
+    if (table->old != NULL && (index = u_stash_find_entry_index(table->old, key, hash)) >= 0) {
+        *value = u_stash_umap_value_at(table->old, (size_t)index);
+        return STASH_KEY_EXISTS;
+    }
+
+    // Room for the dense entry is made first so that nothing can fail past this point
+    if (table->entries.data != NULL) {
+        int ret = u_stash_umap_reserve_entry(table);
+        if (ret < 0) return ret;
+    }
+
+    // Grow the table if this insertion would exceed the max load factor,
+    // long runs from colliding hashes only saturate their distances
+    while (u_stash_umap_live_count(table) + 1 > table->growth_limit) {
+        int ret = u_stash_umap_grow(table);
+        if (ret < 0) return ret;
+        u_stash_umap_probe_slot(table, hash, &pos, &dist);
+    }
+
+    u_stash_umap_make_room(table, pos, dist);
+
+    // Claim the slot, the value is left to the caller
+    memcpy(u_stash_umap_key_at(table, pos), key, table->key_size);
+    u_stash_umap_set_ctrl(table, pos, u_stash_umap_h2(hash));
+
+    if (table->entries.data != NULL) {
+        u_stash_umap_push_entry(table, pos, key);
+    }
+
+    *value = u_stash_umap_value_at(table, pos);
+
+    table->count++;
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_umap_bulk_insert(stash_umap* table, const void* keys, const void* values, size_t n)
+{
+    // The table is empty and already sized for 'n' elements
+
+    size_t bucket_count = table->buckets.count;
+    size_t mask = bucket_count - 1;
+
+    uint64_t* hashes = (uint64_t*)STASH_MALLOC(n * sizeof(uint64_t));
+    size_t* order = (size_t*)STASH_MALLOC(n * sizeof(size_t));
+    size_t* starts = (size_t*)STASH_MALLOC((bucket_count + 1) * sizeof(size_t));
+
+    if (hashes == NULL || order == NULL || starts == NULL) {
+        STASH_FREE(hashes);
+        STASH_FREE(order);
+        STASH_FREE(starts);
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    // First pass: hash every key and sort them by home bucket (counting sort,
+    // stable so that the first occurrence of a duplicate key is the one kept)
+
+    memset(starts, 0, (bucket_count + 1) * sizeof(size_t));
+
+    for (size_t i = 0; i < n; i++) {
+        hashes[i] = u_stash_umap_hash(table, (const char*)keys + i * table->key_size);
+        starts[(hashes[i] & mask) + 1]++;
+    }
+
+    for (size_t i = 0; i < bucket_count; i++) {
+        starts[i + 1] += starts[i];
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        order[starts[hashes[i] & mask]++] = i;
+    }
+
+    STASH_FREE(starts);
+
+    // Second pass: the buckets are filled from left to right, each key goes to its home
+    // or right after the previous one, which is the layout Robin Hood insertion would give
+
+    uint8_t* dists = (uint8_t*)table->dists.data;
+    size_t next = 0;            //< First slot after the last placed key
+    size_t home_begin = 0;      //< First slot holding a key of the current home
+    size_t prev_home = SIZE_MAX;
+    size_t deferred = 0;        //< Keys left for a regular insertion, stored at the front of 'order'
+
+    for (size_t k = 0; k < n; k++) {
+        size_t i = order[k];
+        const void* key = (const char*)keys + i * table->key_size;
+        size_t home = hashes[i] & mask;
+
+        // Input keys are read in home order, fetch them a few iterations ahead
+        if (k + STASH_UMAP_BATCH_SIZE < n) {
+            size_t ahead = order[k + STASH_UMAP_BATCH_SIZE];
+            U_STASH_PREFETCH(&hashes[ahead]);
+            U_STASH_PREFETCH((const char*)keys + ahead * table->key_size);
+            if (values != NULL) U_STASH_PREFETCH((const char*)values + ahead * table->value_size);
+        }
+        size_t pos = (next > home) ? next : home;
+        uint8_t h2 = u_stash_umap_h2(hashes[i]);
+
+        // Keys that would wrap around are inserted afterwards
+        if (pos >= bucket_count) {
+            order[deferred++] = i;
+            continue;
+        }
+
+        if (home != prev_home) {
+            home_begin = pos;
+            prev_home = home;
+        }
+
+        // A duplicate can only be among the keys of the same home, placed just before
+        bool duplicate = false;
+        for (size_t j = home_begin; j < pos && !duplicate; j++) {
+            duplicate = ((const uint8_t*)table->ctrl.data)[j] == h2
+                && u_stash_umap_key_eq(table, u_stash_umap_key_at(table, j), key);
+        }
+        if (duplicate) continue;
+
+        memcpy(u_stash_umap_key_at(table, pos), key, table->key_size);
+        u_stash_umap_set_ctrl(table, pos, h2);
+        dists[pos] = (uint8_t)u_stash_umap_dist_cap(pos - home);
+
+        void* value = u_stash_umap_value_at(table, pos);
+        if (values != NULL) memcpy(value, (const char*)values + i * table->value_size, table->value_size);
+        else memset(value, 0, table->value_size);
+
+        table->count++;
+        next = pos + 1;
+    }
+
+    int ret = STASH_SUCCESS;
+
+    for (size_t k = 0; k < deferred && ret >= 0; k++) {
+        size_t i = order[k];
+        void* value;
+
+        ret = u_stash_umap_emplace(table, (const char*)keys + i * table->key_size, &value);
+        if (ret == STASH_SUCCESS) {
+            if (values != NULL) memcpy(value, (const char*)values + i * table->value_size, table->value_size);
+            else memset(value, 0, table->value_size);
+        }
+    }
+
+    STASH_FREE(hashes);
+    STASH_FREE(order);
+
+    return (ret < 0) ? ret : STASH_SUCCESS;
+}
+
+static inline bool u_stash_umap_has_u32_keys(const stash_umap* table)
+{
+    // The uint32_t key API only applies to tables created with 4 byte keys
+    return stash_umap_is_valid(table) && table->key_size == sizeof(uint32_t);
+}
+
+#if !defined(STASH_NO_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#   define U_STASH_MMAP
+#endif
+
+#include <stdio.h>
+
+#define U_STASH_UMAP_FILE_VERSION 1
+#define U_STASH_UMAP_FILE_ALIGN 64      //< Alignment of each array inside a snapshot
+#define U_STASH_UMAP_FILE_MIRROR 31     //< Control bytes mirrored after the end, enough for the widest group
+
+typedef struct {
+    char magic[8];              // "STASHMAP"
+    uint32_t version;           // U_STASH_UMAP_FILE_VERSION
+    uint32_t byte_order;        // 0x01020304 as stored by the machine that saved the file
+    uint32_t flags;             // Layout flags of the table
+    uint32_t hash_id;           // Built-in hash function of the table (0 for a custom one)
+    uint64_t seed;              // Seed given to the hash function
+    uint64_t count;             // Number of elements
+    uint64_t tombstones;        // Dead dense entries (ordered only)
+    uint64_t key_size;          // Size of the keys
+    uint64_t value_size;        // Size of the values
+    uint64_t value_offset;      // Offset of the value in a slot or dense entry
+    uint64_t bucket_count;      // Number of buckets (power of two)
+    uint64_t bucket_stride;     // Size of a bucket
+    uint64_t entry_count;       // Number of dense entries (ordered only)
+    uint64_t entry_stride;      // Size of a dense entry (ordered only)
+    uint64_t ctrl_offset;       // Offsets of the arrays from the start of the file,
+    uint64_t dists_offset;      // zero when the table does not use that array
+    uint64_t buckets_offset;
+    uint64_t values_offset;
+    uint64_t entries_offset;
+    uint64_t live_offset;
+    uint64_t file_size;         // Total size of the file
+    float max_load_factor;      // Maximum load factor of the table
+    uint32_t reserved;          // Always zero
+} u_stash_umap_file;
+
+static uint32_t u_stash_umap_hash_id(stash_hash_fn hash)
+{
+    if (hash == stash_hash_mix) return 1;
+    if (hash == stash_hash_identity) return 2;
+    if (hash == stash_hash_fibonacci) return 3;
+    return 0;
+}
+
+static stash_hash_fn u_stash_umap_hash_from_id(uint32_t id)
+{
+    switch (id) {
+        case 1: return stash_hash_mix;
+        case 2: return stash_hash_identity;
+        case 3: return stash_hash_fibonacci;
+        default: return NULL;
+    }
+}
+
+static inline uint64_t u_stash_umap_file_align(uint64_t offset)
+{
+    return (offset + U_STASH_UMAP_FILE_ALIGN - 1) & ~(uint64_t)(U_STASH_UMAP_FILE_ALIGN - 1);
+}
+
+static void u_stash_umap_file_layout(u_stash_umap_file* header)
+{
+    // Arrays follow the header in a fixed order, each one aligned so that it can be used in place
+
+    bool split = (header->flags & STASH_UMAP_SPLIT) && header->value_size > 0;
+    bool ordered = (header->flags & STASH_UMAP_ORDERED) != 0;
+    uint64_t offset = u_stash_umap_file_align(sizeof(u_stash_umap_file));
+
+    header->ctrl_offset = offset;
+    offset = u_stash_umap_file_align(offset + header->bucket_count + U_STASH_UMAP_FILE_MIRROR);
+
+    header->dists_offset = offset;
+    offset = u_stash_umap_file_align(offset + header->bucket_count);
+
+    header->buckets_offset = offset;
+    offset = u_stash_umap_file_align(offset + header->bucket_count * header->bucket_stride);
+
+    header->values_offset = 0;
+    if (split) {
+        header->values_offset = offset;
+        offset = u_stash_umap_file_align(offset + header->bucket_count * header->value_size);
+    }
+
+    header->entries_offset = header->live_offset = 0;
+    if (ordered) {
+        header->entries_offset = offset;
+        offset = u_stash_umap_file_align(offset + header->entry_count * header->entry_stride);
+        header->live_offset = offset;
+        offset = u_stash_umap_file_align(offset + header->entry_count);
+    }
+
+    header->file_size = offset;
+}
+
+static bool u_stash_umap_file_check(const u_stash_umap_file* header, size_t size)
+{
+    // Checks that the header describes arrays that exactly fill the file
+
+    if (memcmp(header->magic, "STASHMAP", sizeof(header->magic)) != 0
+        || (header->flags & STASH_UMAP_SMALL)
+        || header->version != U_STASH_UMAP_FILE_VERSION
+        || header->byte_order != 0x01020304) {
+        return false;
+    }
+
+    uint64_t n = header->bucket_count;
+    if (n == 0 || (n & (n - 1)) != 0 || n > size || header->count >= n || header->key_size == 0) {
+        return false;
+    }
+
+    // Every array must fit in the file before its offset is computed
+    bool split = (header->flags & STASH_UMAP_SPLIT) && header->value_size > 0;
+    uint64_t limit = size / n;
+    if (header->bucket_stride < header->key_size || header->bucket_stride > limit || (split && header->value_size > limit)
+        || header->entry_count > size || (header->entry_count > 0 && header->entry_stride > size / header->entry_count)) {
+        return false;
+    }
+
+    // Compared one at a time first, so that their sum cannot wrap around
+    if (header->value_offset > size || header->value_size > size) {
+        return false;
+    }
+
+    if (header->flags & STASH_UMAP_ORDERED) {
+        size_t index_offset = (size_t)((header->key_size + sizeof(uint32_t) - 1) & ~(uint64_t)(sizeof(uint32_t) - 1));
+        if (header->bucket_stride < index_offset + sizeof(uint32_t)
+            || header->entry_stride < header->value_offset + header->value_size
+            || header->entry_count != header->count + header->tombstones) {
+            return false;
+        }
+    }
+    else if (header->entry_count != 0 || header->tombstones != 0
+        || (!(header->flags & STASH_UMAP_SPLIT) && header->bucket_stride < header->value_offset + header->value_size)) {
+        return false;
+    }
+
+    u_stash_umap_file expected = *header;
+    u_stash_umap_file_layout(&expected);
+
+    return expected.file_size == size
+        && expected.ctrl_offset == header->ctrl_offset
+        && expected.dists_offset == header->dists_offset
+        && expected.buckets_offset == header->buckets_offset
+        && expected.values_offset == header->values_offset
+        && expected.entries_offset == header->entries_offset
+        && expected.live_offset == header->live_offset;
+}
+
+static bool u_stash_umap_file_check_arrays(const u_stash_umap_file* header, const char* memory)
+{
+    // Lookups trust the arrays: every probe must reach an empty slot and every ordered
+    // bucket must point to a live entry. One pass over the control and distance bytes
+    // (and the entry indices of ordered tables), the keys and values are not read.
+
+    const uint8_t* ctrl = (const uint8_t*)(memory + header->ctrl_offset);
+    const uint8_t* dists = (const uint8_t*)(memory + header->dists_offset);
+    const uint8_t* live = (const uint8_t*)(memory + header->live_offset);
+    bool ordered = (header->flags & STASH_UMAP_ORDERED) != 0;
+    size_t index_offset = (size_t)((header->key_size + sizeof(uint32_t) - 1) & ~(uint64_t)(sizeof(uint32_t) - 1));
+    size_t mask = (size_t)header->bucket_count - 1;
+    uint64_t full = 0, live_count = 0;
+
+    for (size_t i = 0; i <= mask; i++) {
+        if (ctrl[i] == U_STASH_CTRL_EMPTY) {
+            continue;
+        }
+        if (ctrl[i] & U_STASH_CTRL_EMPTY) {
+            return false; //< Neither empty nor a hash tag
+        }
+
+        // A slot away from its home continues the run of the slot before it
+        size_t prev = (i - 1) & mask;
+        if (dists[i] > 0 && (ctrl[prev] & U_STASH_CTRL_EMPTY)) {
+            return false;
+        }
+
+        if (ordered) {
+            uint32_t entry;
+            memcpy(&entry, memory + header->buckets_offset + i * header->bucket_stride + index_offset, sizeof(entry));
+            if (entry >= header->entry_count || live[entry] != 1) {
+                return false;
+            }
+        }
+
+        full++;
+    }
+
+    for (size_t i = 0; i < U_STASH_UMAP_FILE_MIRROR; i++) {
+        if (ctrl[mask + 1 + i] != ctrl[i & mask]) {
+            return false;
+        }
+    }
+
+    for (size_t i = 0; ordered && i < header->entry_count; i++) {
+        if (live[i] > 1) return false;
+        live_count += live[i];
+    }
+
+    return full == header->count && (!ordered || live_count == header->count);
+}
+
+static bool u_stash_umap_file_write(FILE* file, uint64_t* pos, uint64_t offset, const void* data, size_t size)
+{
+    // Pads with zeros up to 'offset' then writes the data
+    static const char zeros[U_STASH_UMAP_FILE_ALIGN] = { 0 };
+
+    while (*pos < offset) {
+        size_t n = (size_t)(offset - *pos);
+        if (n > sizeof(zeros)) n = sizeof(zeros);
+        if (fwrite(zeros, 1, n, file) != n) return false;
+        *pos += n;
+    }
+
+    if (size > 0 && fwrite(data, 1, size, file) != size) {
+        return false;
+    }
+
+    *pos += size;
+
+    return true;
+}
+
+static void* u_stash_umap_file_load(const char* path, size_t* size)
+{
+#ifdef U_STASH_MMAP
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    void* memory = NULL;
+    struct stat st;
+
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        // Private mapping: values changed in place are never written back to the file
+        memory = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED) memory = NULL;
+        else *size = (size_t)st.st_size;
+    }
+
+    close(fd);
+
+    return memory;
+#else
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) return NULL;
+
+    void* memory = NULL;
+    long length = (fseek(file, 0, SEEK_END) == 0) ? ftell(file) : -1;
+
+    if (length > 0 && fseek(file, 0, SEEK_SET) == 0) {
+        memory = STASH_MALLOC((size_t)length);
+        if (memory != NULL && fread(memory, 1, (size_t)length, file) != (size_t)length) {
+            STASH_FREE(memory);
+            memory = NULL;
+        }
+        if (memory != NULL) {
+            *size = (size_t)length;
+        }
+    }
+
+    fclose(file);
+
+    return memory;
+#endif
+}
+
+static void u_stash_umap_file_release(void* memory, size_t size)
+{
+#ifdef U_STASH_MMAP
+    munmap(memory, size);
+#else
+    (void)size;
+    STASH_FREE(memory);
+#endif
+}
+
+static inline stash_arr u_stash_umap_file_array(char* memory, uint64_t offset, uint64_t count, uint64_t elem_size)
+{
+    stash_arr array = { 0 };
+
+    if (offset != 0) {
+        array.data = memory + offset;
+        array.count = array.capacity = (size_t)count;
+        array.elem_size = (size_t)elem_size;
+    }
+
+    return array;
+}
+
+static int u_stash_umap_file_save(const stash_umap* table, const char* path)
+{
+    u_stash_umap_file header;
+    memset(&header, 0, sizeof(header));
+
+    memcpy(header.magic, "STASHMAP", sizeof(header.magic));
+    header.version = U_STASH_UMAP_FILE_VERSION;
+    header.byte_order = 0x01020304;
+    header.flags = table->flags;
+    header.hash_id = u_stash_umap_hash_id(table->hash);
+    header.seed = table->seed;
+    header.count = table->count;
+    header.tombstones = table->tombstones;
+    header.key_size = table->key_size;
+    header.value_size = table->value_size;
+    header.value_offset = table->value_offset;
+    header.bucket_count = table->buckets.count;
+    header.bucket_stride = table->buckets.elem_size;
+    header.entry_count = table->entries.count;
+    header.entry_stride = table->entries.elem_size;
+    header.max_load_factor = table->max_load_factor;
+
+    u_stash_umap_file_layout(&header);
+
+    // Control bytes are mirrored for the widest group, so any build can probe the file
+    const uint8_t* ctrl = (const uint8_t*)table->ctrl.data;
+    uint8_t mirror[U_STASH_UMAP_FILE_MIRROR];
+    for (size_t i = 0; i < U_STASH_UMAP_FILE_MIRROR; i++) {
+        mirror[i] = ctrl[i & (table->buckets.count - 1)];
+    }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        return STASH_ERROR_IO;
+    }
+
+    uint64_t pos = 0;
+    size_t n = table->buckets.count;
+
+    bool ok = u_stash_umap_file_write(file, &pos, 0, &header, sizeof(header))
+        && u_stash_umap_file_write(file, &pos, header.ctrl_offset, ctrl, n)
+        && u_stash_umap_file_write(file, &pos, pos, mirror, sizeof(mirror))
+        && u_stash_umap_file_write(file, &pos, header.dists_offset, table->dists.data, n)
+        && u_stash_umap_file_write(file, &pos, header.buckets_offset, table->buckets.data, n * table->buckets.elem_size);
+
+    if (ok && header.values_offset != 0) {
+        ok = u_stash_umap_file_write(file, &pos, header.values_offset, table->values.data, n * table->value_size);
+    }
+
+    if (ok && header.entries_offset != 0) {
+        ok = u_stash_umap_file_write(file, &pos, header.entries_offset, table->entries.data, table->entries.count * table->entries.elem_size)
+            && u_stash_umap_file_write(file, &pos, header.live_offset, table->live.data, table->live.count);
+    }
+
+    ok = ok && u_stash_umap_file_write(file, &pos, header.file_size, NULL, 0);
+
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+
+    return ok ? STASH_SUCCESS : STASH_ERROR_IO;
+}
+
+typedef void (*u_stash_umap_visit_fn)(void* context, size_t index, const void* key, const void* value);
+
+static void u_stash_umap_visit(const stash_umap* table, u_stash_umap_visit_fn visit, void* context)
+{
+    // Elements are numbered in the same order on every walk
+    size_t n = 0;
+
+    if (table->flags & STASH_UMAP_SMALL) {
+        for (size_t i = 0; i < table->count; i++) {
+            visit(context, n++, &table->small_keys[i], u_stash_umap_value_at(table, i));
+        }
+        return;
+    }
+
+    for (const stash_umap* part = table; part != NULL; part = part->old) {
+        for (size_t i = 0; i < part->buckets.count; i++) {
+            if (u_stash_umap_is_full(part, i)) {
+                visit(context, n++, u_stash_umap_key_at(part, i), u_stash_umap_value_at(part, i));
+            }
+        }
+    }
+}
+
+static void u_stash_umap_copy_entry(void* context, size_t index, const void* key, const void* value)
+{
+    stash_umap* copy = (stash_umap*)context;
+    void* slot;
+    (void)index;
+
+    if (u_stash_umap_emplace(copy, key, &slot) == STASH_SUCCESS) {
+        memcpy(slot, value, copy->value_size);
+    }
+}
+
+/* === Public Table Implementation === */
+
+stash_umap stash_umap_create(size_t initialCapacity, size_t value_size)
+{
+    return stash_umap_create_ex(initialCapacity, value_size, STASH_UMAP_INLINE);
+}
+
+stash_umap stash_umap_create_ex(size_t initialCapacity, size_t value_size, uint32_t flags)
+{
+    return stash_umap_create_keyed(initialCapacity, sizeof(uint32_t), value_size, flags);
+}
+
+stash_umap stash_umap_create_keyed(size_t initialCapacity, size_t key_size, size_t value_size, uint32_t flags)
+{
+    stash_umap table = { 0 };
+
+    if (key_size == 0) {
+        return table;
+    }
+
+    // Dense entries never move on growth, so ordered tables always rehash at once
+    if (flags & STASH_UMAP_ORDERED) {
+        flags &= ~(STASH_UMAP_SPLIT | STASH_UMAP_INCREMENTAL);
+    }
+
+    // The inline key scan is only for uint32_t keys with a value
+    if ((flags & STASH_UMAP_ORDERED) || key_size != sizeof(uint32_t) || value_size == 0
+        || initialCapacity > STASH_UMAP_SMALL_SIZE) {
+        flags &= ~(uint32_t)STASH_UMAP_SMALL;
+    }
+
+    table.key_size = key_size;
+    table.value_size = value_size;
+    table.hash = STASH_UMAP_HASH;
+    table.flags = flags;
+
+    // Keys are aligned on the largest power of two dividing their size (up to 8)
+    size_t key_align = key_size & (~key_size + 1);
+    if (key_align > sizeof(uint64_t)) key_align = sizeof(uint64_t);
+
+    size_t stride = key_size;
+
+    if (!(flags & STASH_UMAP_SPLIT)) {
+        stride = u_stash_umap_slot_layout(key_size, value_size, &table.value_offset);
+    }
+
+    if (flags & STASH_UMAP_ORDERED) {
+        // The slot layout computed above is used by the dense entries,
+        // the buckets only keep the key and the index of its entry
+        size_t entry_capacity = (initialCapacity > 16) ? initialCapacity : 16;
+        table.entries = stash_arr_create(entry_capacity, stride);
+        table.live = stash_arr_create(entry_capacity, sizeof(uint8_t));
+
+        if (!stash_arr_is_valid(&table.entries) || !stash_arr_is_valid(&table.live)) {
+            stash_arr_destroy(&table.entries);
+            stash_arr_destroy(&table.live);
+            return table;
+        }
+
+        size_t align = (key_align > sizeof(uint32_t)) ? key_align : sizeof(uint32_t);
+        stride = (u_stash_umap_index_offset(&table) + sizeof(uint32_t) + align - 1) & ~(align - 1);
+    }
+
+    table.max_load_factor = STASH_UMAP_MAX_LOAD_FACTOR;
+
+    if (flags & STASH_UMAP_SMALL) {
+        // Values get a single small array, the bucket stride is kept for the promotion
+        table.buckets.elem_size = stride;
+        table.values = stash_arr_create(STASH_UMAP_SMALL_SIZE, value_size);
+
+        if (stash_arr_is_valid(&table.values)) {
+            u_stash_umap_update_growth_limit(&table);
+        }
+        else {
+            table.flags = 0;
+        }
+
+        return table;
+    }
+
+    size_t actual_capacity = u_stash_umap_buckets_for(&table, initialCapacity);
+    if (actual_capacity < 16) actual_capacity = 16;
+    if (actual_capacity < STASH_UMAP_GROUP_WIDTH) actual_capacity = STASH_UMAP_GROUP_WIDTH;
+
+    if (u_stash_umap_alloc_buckets(&table, actual_capacity, stride) == STASH_SUCCESS) {
+        u_stash_umap_update_growth_limit(&table);
+    }
+    else {
+        stash_arr_destroy(&table.entries);
+        stash_arr_destroy(&table.live);
+    }
+
+    return table;
+}
+
+stash_umap stash_umap_build(const uint32_t* keys, const void* values, size_t n, size_t value_size)
+{
+    return stash_umap_build_keyed(keys, sizeof(uint32_t), values, n, value_size, STASH_UMAP_INLINE);
+}
+
+stash_umap stash_umap_build_keyed(const void* keys, size_t key_size, const void* values, size_t n, size_t value_size, uint32_t flags)
+{
+    stash_umap table = stash_umap_create_keyed(n, key_size, value_size, flags);
+
+    if (!stash_umap_is_valid(&table) || n == 0) {
+        return table;
+    }
+
+    int ret = STASH_SUCCESS;
+
+    if (keys == NULL) {
+        ret = STASH_ERROR_OUT_OF_BOUNDS;
+    }
+    else if (table.entries.data != NULL || (table.flags & STASH_UMAP_SMALL)) {
+        // Dense entries follow the input order, ordered (and small) tables are filled one key at a time
+        for (size_t i = 0; i < n && ret >= 0; i++) {
+            void* value;
+            ret = u_stash_umap_emplace(&table, (const char*)keys + i * key_size, &value);
+            if (ret == STASH_SUCCESS) {
+                if (values != NULL) memcpy(value, (const char*)values + i * value_size, value_size);
+                else memset(value, 0, value_size);
+            }
+        }
+    }
+    else {
+        ret = u_stash_umap_bulk_insert(&table, keys, values, n);
+    }
+
+    if (ret < 0) {
+        stash_umap_destroy(&table);
+    }
+
+    return table;
+}
+
+int stash_umap_reserve(stash_umap* table, size_t newCapacity)
+{
+    if (!stash_umap_is_valid(table) || newCapacity < table->count) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (newCapacity <= table->growth_limit && table->old == NULL) {
+        return STASH_SUCCESS;
+    }
+
+    return stash_umap_rehash(table, u_stash_umap_buckets_for(table, newCapacity));
+}
+
+int stash_umap_rehash(stash_umap* table, size_t bucket_count)
+{
+    if (!stash_umap_is_valid(table)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    int ret = u_stash_umap_finish_migration(table);
+    if (ret < 0) return ret;
+
+    return u_stash_umap_rebuild(table, bucket_count);
+}
+
+bool stash_umap_rehash_step(stash_umap* table, size_t steps)
+{
+    if (!stash_umap_is_valid(table)) {
+        return false;
+    }
+
+    u_stash_umap_migrate(table, steps);
+
+    return table->old != NULL;
+}
+
+int stash_umap_shrink_to_fit(stash_umap* table)
+{
+    if (!stash_umap_is_valid(table)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (table->mapping != NULL) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    int ret = u_stash_umap_finish_migration(table);
+    if (ret < 0) return ret;
+
+    // Dense entries are packed first, the buckets are then rebuilt over them
+    if (table->entries.data != NULL && table->entries.count > 0) {
+        if (table->tombstones > 0) {
+            ret = u_stash_umap_compact_entries(table);
+            if (ret < 0) return ret;
+        }
+        if (stash_arr_shrink_to_fit(&table->entries) < 0 || stash_arr_shrink_to_fit(&table->live) < 0) {
+            return STASH_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    // Smallest bucket array that holds the elements under the max load factor
+    size_t bucket_count = u_stash_umap_buckets_for(table, table->count);
+    if (bucket_count < STASH_UMAP_GROUP_WIDTH) bucket_count = STASH_UMAP_GROUP_WIDTH;
+
+    if (bucket_count >= table->buckets.count) {
+        return STASH_SUCCESS;
+    }
+
+    return u_stash_umap_rebuild(table, bucket_count);
+}
+
+float stash_umap_load_factor(const stash_umap* table)
+{
+    if (!stash_umap_is_valid(table)) return 0.0f;
+    if (table->flags & STASH_UMAP_SMALL) return (float)table->count / (float)STASH_UMAP_SMALL_SIZE;
+
+    // While migrating, the elements are spread over both bucket arrays (as in stash_umap_stats)
+    size_t bucket_count = table->buckets.count;
+    if (table->old != NULL) bucket_count += table->old->buckets.count;
+
+    return (float)table->count / (float)bucket_count;
+}
+
+int stash_umap_set_max_load_factor(stash_umap* table, float max_load_factor)
+{
+    if (!stash_umap_is_valid(table) || !(max_load_factor > 0.0f && max_load_factor < 1.0f)) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    int ret = u_stash_umap_finish_migration(table);
+    if (ret < 0) return ret;
+
+    float prev_load_factor = table->max_load_factor;
+    size_t prev_growth_limit = table->growth_limit;
+
+    table->max_load_factor = max_load_factor;
+    u_stash_umap_update_growth_limit(table);
+
+    // Grow right away if the table is now above the new limit, the old limit stays if it cannot
+    if (table->count > table->growth_limit) {
+        ret = u_stash_umap_rebuild(table, u_stash_umap_buckets_for(table, table->count));
+        if (ret < 0) {
+            table->max_load_factor = prev_load_factor;
+            table->growth_limit = prev_growth_limit;
+        }
+    }
+
+    return ret;
+}
+
+int stash_umap_set_hash(stash_umap* table, stash_hash_fn hash, uint64_t seed)
+{
+    if (!stash_umap_is_valid(table) || !hash) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    int ret = u_stash_umap_finish_migration(table);
+    if (ret < 0) return ret;
+
+    stash_hash_fn prev_hash = table->hash;
+    uint64_t prev_seed = table->seed;
+
+    table->hash = hash;
+    table->seed = seed;
+
+    // Small tables do not hash their keys until they are promoted
+    if (table->count == 0 || (table->flags & STASH_UMAP_SMALL)) {
+        return STASH_SUCCESS;
+    }
+
+    // Existing entries are placed again with the new hash
+    ret = u_stash_umap_rebuild(table, table->buckets.count);
+    if (ret < 0) {
+        table->hash = prev_hash;
+        table->seed = prev_seed;
+    }
+
+    return ret;
+}
+
+void stash_umap_destroy(stash_umap* table)
+{
+    if (!stash_umap_is_valid(table)) {
+        return;
+    }
+
+    if (table->old != NULL) {
+        u_stash_umap_free_old(table);
+    }
+
+    if (table->mapping != NULL) {
+        // The arrays point into the snapshot, they are released with it
+        u_stash_umap_file_release(table->mapping, table->mapping_size);
+        table->buckets = table->values = table->ctrl = table->dists = (stash_arr) { 0 };
+        table->entries = table->live = (stash_arr) { 0 };
+        table->mapping = NULL;
+        table->mapping_size = 0;
+    }
+    else {
+        u_stash_umap_free_buckets(table);
+        stash_arr_destroy(&table->entries);
+        stash_arr_destroy(&table->live);
+    }
+
+    table->tombstones = 0;
+    table->count = 0;
+    table->key_size = 0;
+    table->value_size = 0;
+    table->value_offset = 0;
+    table->growth_limit = 0;
+    table->hash = NULL;
+    table->seed = 0;
+    table->flags = 0;
+}
+
+bool stash_umap_is_valid(const stash_umap* table)
+{
+    if (table && (table->flags & STASH_UMAP_SMALL)) {
+        return stash_arr_is_valid(&table->values);
+    }
+
+    return table
+        && stash_arr_is_valid(&table->buckets)
+        && stash_arr_is_valid(&table->ctrl)
+        && stash_arr_is_valid(&table->dists);
+}
+
+bool stash_umap_is_empty(const stash_umap* table)
+{
+    return !stash_umap_is_valid(table) || table->count == 0;
+}
+
+stash_it stash_umap_begin(stash_umap* table)
+{
+    stash_it it = { 0 };
+
+    if (!stash_umap_is_valid(table) || table->count == 0) {
+        return it;
+    }
+
+    // Iterators only walk the current bucket array
+    u_stash_umap_finish_migration(table);
+
+    // Find the first occupied location
+    for (size_t i = 0; i < u_stash_umap_iter_count(table); i++) {
+        if (u_stash_umap_iter_full(table, i)) {
+            it.curr = u_stash_umap_iter_value(table, i);
+
+            // Store the current index for navigation
+            it.prev = (void*)(uintptr_t)i;
+
+            // Find the next occupied element
+            size_t next_idx = i + 1;
+            while (next_idx < u_stash_umap_iter_count(table)) {
+                if (u_stash_umap_iter_full(table, next_idx)) {
+                    it.next = u_stash_umap_iter_value(table, next_idx);
+                    break;
+                }
+                next_idx++;
+            }
+
+            // If we haven't found a next one, there isn't one.
+            if (next_idx >= u_stash_umap_iter_count(table)) {
+                it.next = NULL;
+            }
+
+            break;
+        }
+    }
+
+    return it;
+}
+
+void stash_umap_previous(stash_umap* table, stash_it* it)
+{
+    if (!stash_umap_is_valid(table) || !it || table->count == 0) {
+        return;
+    }
+
+    // If we are already at the beginning or before
+    if (it->curr == NULL) {
+        // If next is set, we are just before the start
+        if (it->next != NULL) {
+            // We stay before the start
+            return;
+        }
+
+        // Otherwise we go to the end
+        *it = stash_umap_end(table);
+        return;
+    }
+
+    // Retrieve the current index
+    size_t curr_idx = (size_t)(uintptr_t)it->prev;
+
+    // Find the previous occupied element
+    size_t prev_idx = curr_idx;
+    if (prev_idx > 0) {
+        prev_idx--;
+
+        while (prev_idx > 0) {
+            if (u_stash_umap_iter_full(table, prev_idx)) {
+                break;
+            }
+            prev_idx--;
+        }
+
+        if (u_stash_umap_iter_full(table, prev_idx)) {
+            // Save the current pointer
+            void* oldCurr = it->curr;
+
+            // Update the iterator
+            it->curr = u_stash_umap_iter_value(table, prev_idx);
+            it->next = oldCurr;
+            it->prev = (void*)(uintptr_t)prev_idx;
+        }
+        else {
+            // We are before the beginning
+            it->next = it->curr;
+            it->curr = NULL;
+            it->prev = NULL;
+        }
+    }
+    else {
+        // We are before the beginning
+        it->next = it->curr;
+        it->curr = NULL;
+        it->prev = NULL;
+    }
+}
+
+void stash_umap_next(stash_umap* table, stash_it* it)
+{
+    if (!stash_umap_is_valid(table) || !it || table->count == 0) {
+        return;
+    }
+
+    // If we are already at the end or after
+    if (it->curr == NULL) {
+        // If prev is set, we are just after the end
+        if (it->prev != NULL) {
+            // We stay after the end
+            return;
+        }
+
+        // Otherwise, we go to the beginning
+        *it = stash_umap_begin(table);
+        return;
+    }
+
+    // If next is NULL, we are at the end
+    if (it->next == NULL) {
+        // Save current pointer to prev (to allow going back)
+        void* oldCurr = it->curr;
+        it->prev = oldCurr;
+        it->curr = NULL;
+        return;
+    }
+
+    // Retrieve the current index
+    size_t curr_idx = (size_t)(uintptr_t)it->prev;
+
+    // Find the next occupied element
+    size_t next_idx = curr_idx + 1;
+    while (next_idx < u_stash_umap_iter_count(table)) {
+        if (u_stash_umap_iter_full(table, next_idx)) {
+            break;
+        }
+        next_idx++;
+    }
+
+    if (next_idx < u_stash_umap_iter_count(table)) {
+        // Update the iterator
+        it->curr = u_stash_umap_iter_value(table, next_idx);
+        it->prev = (void*)(uintptr_t)next_idx;
+
+        // Find the next occupied element
+        size_t next_next_idx = next_idx + 1;
+        while (next_next_idx < u_stash_umap_iter_count(table)) {
+            if (u_stash_umap_iter_full(table, next_next_idx)) {
+                it->next = u_stash_umap_iter_value(table, next_next_idx);
+                break;
+            }
+            next_next_idx++;
+        }
+
+        // If we haven't found a next one, there isn't one
+        if (next_next_idx >= u_stash_umap_iter_count(table)) {
+            it->next = NULL;
+        }
+    }
+    else {
+        // We are at the end
+        void* oldCurr = it->curr;
+        it->prev = oldCurr;
+        it->curr = NULL;
+        it->next = NULL;
+    }
+}
+
+stash_it stash_umap_end(stash_umap* table)
+{
+    stash_it it = { 0 };
+
+    if (!stash_umap_is_valid(table) || table->count == 0) {
+        return it;
+    }
+
+    // Iterators only walk the current bucket array
+    u_stash_umap_finish_migration(table);
+
+    // Find the last occupied location
+    int64_t i = (int64_t)u_stash_umap_iter_count(table) - 1;
+    while (i >= 0) {
+        if (u_stash_umap_iter_full(table, (size_t)i)) {
+            it.curr = u_stash_umap_iter_value(table, (size_t)i);
+            it.prev = (void*)(uintptr_t)i;
+
+            // For consistency with the rest of the API
+            // next is NULL for the last element
+            it.next = NULL;
+            break;
+        }
+        i--;
+    }
+
+    return it;
+}
+
+int stash_umap_insert(stash_umap* table, uint32_t key, const void* value)
+{
+    if (!u_stash_umap_has_u32_keys(table)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    return stash_umap_insert_key(table, &key, value);
+}
+
+void* stash_umap_emplace(stash_umap* table, uint32_t key, bool* inserted)
+{
+    if (!u_stash_umap_has_u32_keys(table)) {
+        return NULL;
+    }
+
+    return stash_umap_emplace_key(table, &key, inserted);
+}
+
+int stash_umap_remove(stash_umap* table, uint32_t key, void* element)
+{
+    if (!u_stash_umap_has_u32_keys(table)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    return stash_umap_remove_key(table, &key, element);
+}
+
+int stash_umap_get(const stash_umap* table, uint32_t key, void* element)
+{
+    if (!u_stash_umap_has_u32_keys(table)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    return stash_umap_get_key(table, &key, element);
+}
+
+void* stash_umap_find(stash_umap* table, uint32_t key)
+{
+    return (void*)stash_umap_find_const(table, key);
+}
+
+const void* stash_umap_find_const(const stash_umap* table, uint32_t key)
+{
+    if (!u_stash_umap_has_u32_keys(table)) {
+        return NULL;
+    }
+
+    return stash_umap_find_key_const(table, &key);
+}
+
+bool stash_umap_contains(const stash_umap* table, uint32_t key)
+{
+    return u_stash_umap_has_u32_keys(table) && stash_umap_contains_key(table, &key);
+}
+
+int stash_umap_insert_key(stash_umap* table, const void* key, const void* value)
+{
+    if (!stash_umap_is_valid(table) || !key || !value) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    void* slot;
+    int ret = u_stash_umap_emplace(table, key, &slot);
+
+    // Copy the value only if the key was not already present
+    if (ret == STASH_SUCCESS) {
+        memcpy(slot, value, table->value_size);
+    }
+
+    return ret;
+}
+
+void* stash_umap_emplace_key(stash_umap* table, const void* key, bool* inserted)
+{
+    if (!stash_umap_is_valid(table) || !key) {
+        return NULL;
+    }
+
+    void* slot;
+    int ret = u_stash_umap_emplace(table, key, &slot);
+    if (ret < 0) return NULL;
+
+    // Fresh values are zeroed so that counters and aggregates can be updated right away
+    if (ret == STASH_SUCCESS) {
+        memset(slot, 0, table->value_size);
+    }
+
+    if (inserted != NULL) {
+        *inserted = (ret == STASH_SUCCESS);
+    }
+
+    return slot;
+}
+
+int stash_umap_remove_key(stash_umap* table, const void* key, void* element)
+{
+    if (!stash_umap_is_valid(table) || !key) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    if (table->mapping != NULL) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    // Move a few entries if an incremental rehash is in progress
+    if (table->old != NULL) {
+        int ret = u_stash_umap_migrate(table, STASH_UMAP_MIGRATE_STEP);
+        if (ret < 0) return ret;
+    }
+
+    const stash_umap* owner;
+    int64_t index = u_stash_umap_lookup(table, key, &owner);
+    if (index < 0) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    // Copy the value if requested
+    if (element != NULL) {
+        memcpy(element, u_stash_umap_value_at(owner, (size_t)index), table->value_size);
+    }
+
+    if (table->flags & STASH_UMAP_SMALL) {
+        u_stash_umap_small_erase(table, (size_t)index);
+        table->count--;
+        return STASH_SUCCESS;
+    }
+
+    // Ordered entries are only marked as removed, the order of the others is kept
+    if (table->entries.data != NULL) {
+        ((uint8_t*)table->live.data)[u_stash_umap_entry_index(owner, (size_t)index)] = 0;
+        table->tombstones++;
+    }
+
+    // Free the slot and close the gap in the probe sequence
+    u_stash_umap_erase_at((stash_umap*)owner, (size_t)index);
+
+    if (owner == table->old) {
+        table->old->count--;
+    }
+
+    table->count--;
+
+    // Keep iteration proportional to the element count
+    if (table->tombstones > 16 && table->tombstones > table->count) {
+        u_stash_umap_compact_entries(table); //< On failure the tombstones are simply kept
+    }
+
+    return STASH_SUCCESS;
+}
+
+int stash_umap_get_key(const stash_umap* table, const void* key, void* element)
+{
+    if (!stash_umap_is_valid(table) || !key || !element) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    const stash_umap* owner;
+    int64_t index = u_stash_umap_lookup(table, key, &owner);
+    if (index < 0) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    memcpy(element, u_stash_umap_value_at(owner, (size_t)index), table->value_size);
+
+    return STASH_SUCCESS;
+}
+
+void* stash_umap_find_key(stash_umap* table, const void* key)
+{
+    return (void*)stash_umap_find_key_const(table, key);
+}
+
+const void* stash_umap_find_key_const(const stash_umap* table, const void* key)
+{
+    if (!stash_umap_is_valid(table) || !key) {
+        return NULL;
+    }
+
+    // The pointer stays valid until the next insertion or removal
+    const stash_umap* owner;
+    int64_t index = u_stash_umap_lookup(table, key, &owner);
+    if (index < 0) {
+        return NULL;
+    }
+
+    return u_stash_umap_value_at(owner, (size_t)index);
+}
+
+bool stash_umap_contains_key(const stash_umap* table, const void* key)
+{
+    if (!stash_umap_is_valid(table) || !key) return false;
+
+    const stash_umap* owner;
+    return u_stash_umap_lookup(table, key, &owner) >= 0;
+}
+
+size_t stash_umap_get_many(const stash_umap* table, const uint32_t* keys, size_t n, void* elements, uint8_t* found)
+{
+    if (!u_stash_umap_has_u32_keys(table) || !keys || !elements) {
+        return 0;
+    }
+
+    uint64_t hashes[STASH_UMAP_BATCH_SIZE];
+    size_t found_count = 0;
+
+    for (size_t base = 0; base < n; base += STASH_UMAP_BATCH_SIZE) {
+        size_t batch = (n - base < STASH_UMAP_BATCH_SIZE) ? n - base : STASH_UMAP_BATCH_SIZE;
+
+        // First pass: hash the whole batch and issue the loads of each home bucket
+        for (size_t i = 0; i < batch; i++) {
+            hashes[i] = u_stash_umap_hash(table, &keys[base + i]);
+            u_stash_umap_prefetch(table, hashes[i]);
+        }
+
+        // Second pass: resolve the lookups, their memory should be in flight by now
+        for (size_t i = 0; i < batch; i++) {
+            const stash_umap* owner;
+            int64_t index = u_stash_umap_lookup_hashed(table, &keys[base + i], hashes[i], &owner);
+
+            if (index >= 0) {
+                void* element = (char*)elements + (base + i) * table->value_size;
+                memcpy(element, u_stash_umap_value_at(owner, (size_t)index), table->value_size);
+                found_count++;
+            }
+
+            if (found != NULL) {
+                found[base + i] = (index >= 0);
+            }
+        }
+    }
+
+    return found_count;
+}
+
+size_t stash_umap_find_many(stash_umap* table, const uint32_t* keys, size_t n, void** values)
+{
+    if (!u_stash_umap_has_u32_keys(table) || !keys || !values) {
+        return 0;
+    }
+
+    uint64_t hashes[STASH_UMAP_BATCH_SIZE];
+    size_t found_count = 0;
+
+    for (size_t base = 0; base < n; base += STASH_UMAP_BATCH_SIZE) {
+        size_t batch = (n - base < STASH_UMAP_BATCH_SIZE) ? n - base : STASH_UMAP_BATCH_SIZE;
+
+        // First pass: hash the whole batch and issue the loads of each home bucket
+        for (size_t i = 0; i < batch; i++) {
+            hashes[i] = u_stash_umap_hash(table, &keys[base + i]);
+            u_stash_umap_prefetch(table, hashes[i]);
+        }
+
+        // Second pass: resolve the lookups, missing keys give NULL
+        for (size_t i = 0; i < batch; i++) {
+            const stash_umap* owner;
+            int64_t index = u_stash_umap_lookup_hashed(table, &keys[base + i], hashes[i], &owner);
+
+            values[base + i] = (index >= 0) ? u_stash_umap_value_at(owner, (size_t)index) : NULL;
+            found_count += (index >= 0);
+        }
+    }
+
+    return found_count;
+}
+
+void stash_umap_clear(stash_umap* table)
+{
+    if (!stash_umap_is_valid(table) || table->mapping != NULL) {
+        return;
+    }
+
+    if (table->flags & STASH_UMAP_SMALL) {
+        table->count = 0;
+        return;
+    }
+
+    if (table->old != NULL) {
+        u_stash_umap_free_old(table);
+    }
+
+    memset(table->ctrl.data, U_STASH_CTRL_EMPTY, table->ctrl.count);
+
+    table->entries.count = 0;
+    table->live.count = 0;
+    table->tombstones = 0;
+    table->count = 0;
+}
+
+size_t stash_umap_count(const stash_umap* table)
+{
+    return stash_umap_is_valid(table) ? table->count : 0;
+}
+
+int stash_umap_stats(const stash_umap* table, stash_umap_info* info)
+{
+    if (!stash_umap_is_valid(table) || !info) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    memset(info, 0, sizeof(*info));
+
+    size_t total_probe = 0;
+
+    // Probe lengths come from the Robin Hood distances, no key is hashed again
+    for (const stash_umap* part = table; part != NULL; part = part->old) {
+        const uint8_t* dists = (const uint8_t*)part->dists.data;
+
+        for (size_t i = 0; i < part->buckets.count; i++) {
+            if (!u_stash_umap_is_full(part, i)) continue;
+
+            size_t probe = (size_t)dists[i] + 1;
+            size_t bin = (probe <= STASH_UMAP_PROBE_BINS) ? probe - 1 : STASH_UMAP_PROBE_BINS - 1;
+
+            info->probe_histogram[bin]++;
+            total_probe += probe;
+            if (probe > info->max_probe) info->max_probe = probe;
+        }
+
+        info->bucket_count += part->buckets.count;
+
+        if (table->mapping != NULL) {
+            continue; //< Counted below as a whole
+        }
+
+        const stash_arr* arrays[] = { &part->buckets, &part->values, &part->ctrl, &part->dists, &part->entries, &part->live };
+        for (size_t i = 0; i < sizeof(arrays) / sizeof(arrays[0]); i++) {
+            if (arrays[i]->data == NULL) continue;
+            info->allocations++;
+            info->bytes += arrays[i]->capacity * arrays[i]->elem_size;
+        }
+
+        if (part != table) {
+            info->allocations++;
+            info->bytes += sizeof(stash_umap);
+        }
+    }
+
+    if (table->mapping != NULL) {
+        info->allocations = 1;
+        info->bytes = table->mapping_size;
+    }
+
+    // Small tables find any key with a single scan
+    if (table->flags & STASH_UMAP_SMALL) {
+        info->bucket_count = STASH_UMAP_SMALL_SIZE;
+        info->probe_histogram[0] = table->count;
+        info->max_probe = (table->count > 0) ? 1 : 0;
+        total_probe = table->count;
+    }
+
+    info->count = table->count;
+    info->load_factor = (float)table->count / (float)info->bucket_count;
+    info->avg_probe = (table->count > 0) ? (float)total_probe / (float)table->count : 0.0f;
+
+#ifdef STASH_STATS
+    info->lookups = U_STASH_UMAP_STAT_LOAD(table, lookups);
+    info->misses = U_STASH_UMAP_STAT_LOAD(table, misses);
+    info->probe_steps = U_STASH_UMAP_STAT_LOAD(table, probe_steps) + (table->old ? U_STASH_UMAP_STAT_LOAD(table->old, probe_steps) : 0);
+#endif
+
+    return STASH_SUCCESS;
+}
+
+int stash_umap_save(const stash_umap* table, const char* path)
+{
+    if (!stash_umap_is_valid(table) || !path) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    // A snapshot holds a single bucket array: small tables and tables in the middle
+    // of a migration are written from a temporary copy, the table itself is left as is
+    if (!(table->flags & STASH_UMAP_SMALL) && table->old == NULL) {
+        return u_stash_umap_file_save(table, path);
+    }
+
+    stash_umap copy = stash_umap_create_keyed(table->count, table->key_size, table->value_size, table->flags & ~(uint32_t)STASH_UMAP_SMALL);
+    if (!stash_umap_is_valid(&copy)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    copy.hash = table->hash;
+    copy.seed = table->seed;
+    copy.max_load_factor = table->max_load_factor;
+    u_stash_umap_update_growth_limit(&copy);
+
+    int ret = stash_umap_reserve(&copy, table->count);
+    if (ret == STASH_SUCCESS) {
+        u_stash_umap_visit(table, u_stash_umap_copy_entry, &copy);
+        ret = u_stash_umap_finish_migration(&copy);
+    }
+    if (ret == STASH_SUCCESS && copy.count != table->count) {
+        ret = STASH_ERROR_OUT_OF_MEMORY; //< An entry could not be copied
+    }
+    if (ret == STASH_SUCCESS) {
+        ret = u_stash_umap_file_save(&copy, path);
+    }
+
+    stash_umap_destroy(&copy);
+
+    return ret;
+}
+
+int stash_umap_map(stash_umap* table, const char* path, stash_hash_fn hash)
+{
+    if (!table || !path) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    size_t size = 0;
+    char* memory = (char*)u_stash_umap_file_load(path, &size);
+    if (memory == NULL) {
+        return STASH_ERROR_IO;
+    }
+
+    u_stash_umap_file header;
+    if (size >= sizeof(header)) {
+        memcpy(&header, memory, sizeof(header));
+    }
+
+    if (size < sizeof(header) || !u_stash_umap_file_check(&header, size) || !u_stash_umap_file_check_arrays(&header, memory)) {
+        u_stash_umap_file_release(memory, size);
+        return STASH_ERROR_IO;
+    }
+
+    // Custom hash functions cannot be recorded, the caller must give it back
+    if (hash == NULL) {
+        hash = u_stash_umap_hash_from_id(header.hash_id);
+        if (hash == NULL) {
+            u_stash_umap_file_release(memory, size);
+            return STASH_ERROR_OUT_OF_BOUNDS;
+        }
+    }
+
+    stash_umap mapped = { 0 };
+
+    mapped.buckets = u_stash_umap_file_array(memory, header.buckets_offset, header.bucket_count, header.bucket_stride);
+    mapped.values = u_stash_umap_file_array(memory, header.values_offset, header.bucket_count, header.value_size);
+    mapped.ctrl = u_stash_umap_file_array(memory, header.ctrl_offset, header.bucket_count + U_STASH_UMAP_FILE_MIRROR, sizeof(uint8_t));
+    mapped.dists = u_stash_umap_file_array(memory, header.dists_offset, header.bucket_count, sizeof(uint8_t));
+    mapped.entries = u_stash_umap_file_array(memory, header.entries_offset, header.entry_count, header.entry_stride);
+    mapped.live = u_stash_umap_file_array(memory, header.live_offset, header.entry_count, sizeof(uint8_t));
+
+    mapped.count = (size_t)header.count;
+    mapped.tombstones = (size_t)header.tombstones;
+    mapped.key_size = (size_t)header.key_size;
+    mapped.value_size = (size_t)header.value_size;
+    mapped.value_offset = (size_t)header.value_offset;
+    mapped.max_load_factor = header.max_load_factor;
+    mapped.hash = hash;
+    mapped.seed = header.seed;
+    mapped.flags = header.flags;
+    mapped.mapping = memory;
+    mapped.mapping_size = size;
+
+    u_stash_umap_update_growth_limit(&mapped);
+
+    *table = mapped;
+
+    return STASH_SUCCESS;
+}
+
+/* === Private Frozen Table Implementation === */
+
+// A displacement holds an offset in its low bits and a multiplier of a second hash in its high bits
+#define U_STASH_FMAP_OFFSET_BITS 29
+#define U_STASH_FMAP_MAX_COUNT ((size_t)1 << U_STASH_FMAP_OFFSET_BITS)
+#define U_STASH_FMAP_SALTS 16     // Salts tried before giving up (only keys with equal hashes need more than one)
+
+static inline uint64_t u_stash_fmap_hash(const stash_fmap* map, const void* key)
+{
+    // Keys are hashed with their bytes and the salt, never with the table's function: keys
+    // that function collides on would collide under every salt and could never be placed
+    return u_stash_hash_bytes(key, map->key_size, map->seed ^ map->salt);
+}
+
+static inline size_t u_stash_fmap_group(const stash_fmap* map, uint64_t hash)
+{
+    // Upper half of the hash, scaled to the number of groups
+    return (size_t)(((hash >> 32) * map->pilots.count) >> 32);
+}
+
+static inline size_t u_stash_fmap_slot(size_t count, uint64_t hash, uint32_t pilot)
+{
+    // (h1 + d0 * h2 + d1) mod count, the second hash is only needed by the few groups with d0 > 0
+    uint64_t pos = (((hash & 0xFFFFFFFF) * count) >> 32) + (pilot & (U_STASH_FMAP_MAX_COUNT - 1));
+    uint32_t d0 = pilot >> U_STASH_FMAP_OFFSET_BITS;
+
+    if (d0 != 0) {
+        pos += d0 * (((u_stash_hash_u64(hash) >> 32) * count) >> 32);
+        return (size_t)(pos % count);
+    }
+
+    return (size_t)((pos >= count) ? pos - count : pos);
+}
+
+static inline const void* u_stash_fmap_lookup(const stash_fmap* map, const void* key)
+{
+    if (map->count == 0) return NULL;
+
+    uint64_t hash = u_stash_fmap_hash(map, key);
+    uint32_t pilot = ((const uint32_t*)map->pilots.data)[u_stash_fmap_group(map, hash)];
+    const char* slot = (const char*)map->slots.data + u_stash_fmap_slot(map->count, hash, pilot) * map->slots.elem_size;
+
+    // Every slot is full, the key is only compared to reject keys that were never frozen
+    if (map->key_size == sizeof(uint32_t)) {
+        uint32_t x, y;
+        memcpy(&x, slot, sizeof(x));
+        memcpy(&y, key, sizeof(y));
+        return (x == y) ? slot + map->value_offset : NULL;
+    }
+
+    return (memcmp(slot, key, map->key_size) == 0) ? slot + map->value_offset : NULL;
+}
+
+static int u_stash_fmap_assign(stash_fmap* map, const uint64_t* hashes, uint32_t* starts, uint32_t* fill, uint32_t* members, uint8_t* taken)
+{
+    size_t n = map->count;
+    size_t groups = map->pilots.count;
+    uint32_t* pilots = (uint32_t*)map->pilots.data;
+
+    // Counting sort of the keys by group
+    memset(starts, 0, (groups + 1) * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        starts[u_stash_fmap_group(map, hashes[i]) + 1]++;
+    }
+
+    size_t largest = 0;
+    for (size_t g = 0; g < groups; g++) {
+        if (starts[g + 1] > largest) largest = starts[g + 1];
+        starts[g + 1] += starts[g];
+        fill[g] = starts[g];
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        members[fill[u_stash_fmap_group(map, hashes[i])]++] = (uint32_t)i;
+    }
+
+    memset(pilots, 0, groups * sizeof(uint32_t));
+    memset(taken, 0, n);
+
+    // Largest groups first, while most slots are still free
+    size_t free_slot = 0;
+
+    for (size_t size = largest; size > 0; size--) {
+        for (size_t g = 0; g < groups; g++) {
+            if (starts[g + 1] - starts[g] != size) continue;
+
+            const uint32_t* keys = members + starts[g];
+
+            if (size == 1) {
+                // Lone keys come last, there are exactly as many as free slots:
+                // the offset that sends the key to the next free slot is solved directly
+                while (taken[free_slot]) free_slot++;
+
+                size_t home = u_stash_fmap_slot(n, hashes[keys[0]], 0);
+                pilots[g] = (uint32_t)((free_slot + n - home) % n);
+                taken[free_slot] = 1;
+                continue;
+            }
+
+            // Offsets and multipliers are tried in turn, so that two keys
+            // with the same first hash are split by the second one early
+            for (uint64_t attempt = 0; ; attempt++) {
+                uint64_t d0 = attempt % (1u << (32 - U_STASH_FMAP_OFFSET_BITS));
+                uint64_t d1 = attempt / (1u << (32 - U_STASH_FMAP_OFFSET_BITS));
+
+                if (d1 >= n) {
+                    return STASH_ERROR_OUT_OF_BOUNDS;
+                }
+
+                uint32_t pilot = (uint32_t)((d0 << U_STASH_FMAP_OFFSET_BITS) | d1);
+
+                size_t placed = 0;
+                for (; placed < size; placed++) {
+                    size_t pos = u_stash_fmap_slot(n, hashes[keys[placed]], pilot);
+                    if (taken[pos]) break;
+                    taken[pos] = 1;
+                }
+
+                if (placed == size) {
+                    pilots[g] = pilot;
+                    break;
+                }
+
+                while (placed-- > 0) {
+                    taken[u_stash_fmap_slot(n, hashes[keys[placed]], pilot)] = 0;
+                }
+            }
+        }
+    }
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_fmap_place(stash_fmap* map, const uint64_t* hashes)
+{
+    size_t groups = map->pilots.count;
+
+    uint32_t* starts = (uint32_t*)STASH_MALLOC((groups + 1) * sizeof(uint32_t));
+    uint32_t* fill = (uint32_t*)STASH_MALLOC(groups * sizeof(uint32_t));
+    uint32_t* members = (uint32_t*)STASH_MALLOC(map->count * sizeof(uint32_t));
+    uint8_t* taken = (uint8_t*)STASH_MALLOC(map->count);
+
+    int ret = STASH_ERROR_OUT_OF_MEMORY;
+    if (starts && fill && members && taken) {
+        ret = u_stash_fmap_assign(map, hashes, starts, fill, members, taken);
+    }
+
+    if (starts) STASH_FREE(starts);
+    if (fill) STASH_FREE(fill);
+    if (members) STASH_FREE(members);
+    if (taken) STASH_FREE(taken);
+
+    return ret;
+}
+
+typedef struct {
+    stash_fmap* map;
+    uint64_t* hashes;
+} u_stash_fmap_build;
+
+static void u_stash_fmap_hash_entry(void* context, size_t index, const void* key, const void* value)
+{
+    u_stash_fmap_build* build = (u_stash_fmap_build*)context;
+    (void)value;
+
+    build->hashes[index] = u_stash_fmap_hash(build->map, key);
+}
+
+static void u_stash_fmap_store_entry(void* context, size_t index, const void* key, const void* value)
+{
+    u_stash_fmap_build* build = (u_stash_fmap_build*)context;
+    stash_fmap* map = build->map;
+
+    uint64_t hash = build->hashes[index];
+    uint32_t pilot = ((const uint32_t*)map->pilots.data)[u_stash_fmap_group(map, hash)];
+    char* slot = (char*)map->slots.data + u_stash_fmap_slot(map->count, hash, pilot) * map->slots.elem_size;
+
+    memcpy(slot, key, map->key_size);
+    memcpy(slot + map->value_offset, value, map->value_size);
+}
+
+/* === Public Frozen Table Implementation === */
+
+int stash_umap_freeze(const stash_umap* table, stash_fmap* frozen)
+{
+    if (!stash_umap_is_valid(table) || !frozen) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+    if (table->count >= U_STASH_FMAP_MAX_COUNT) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    stash_fmap map = { 0 };
+    map.count = table->count;
+    map.key_size = table->key_size;
+    map.value_size = table->value_size;
+    map.seed = table->seed;
+
+    size_t stride = u_stash_umap_slot_layout(map.key_size, map.value_size, &map.value_offset);
+    size_t groups = (map.count + STASH_FMAP_GROUP_SIZE - 1) / STASH_FMAP_GROUP_SIZE;
+
+    // Empty maps still get their arrays, so that they stay valid
+    map.pilots = stash_arr_create(groups ? groups : 1, sizeof(uint32_t));
+    map.slots = stash_arr_create(map.count ? map.count : 1, stride);
+    uint64_t* hashes = (uint64_t*)STASH_MALLOC((map.count ? map.count : 1) * sizeof(uint64_t));
+
+    if (!stash_fmap_is_valid(&map) || !hashes) {
+        if (hashes) STASH_FREE(hashes);
+        stash_fmap_destroy(&map);
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    map.pilots.count = groups;
+    map.slots.count = map.count;
+
+    u_stash_fmap_build build = { &map, hashes };
+    int ret = STASH_SUCCESS;
+
+    if (map.count > 0) {
+        ret = STASH_ERROR_OUT_OF_BOUNDS;
+
+        // Only keys whose hashes are equal cannot be separated, a new salt changes them
+        for (uint64_t attempt = 0; attempt < U_STASH_FMAP_SALTS && ret == STASH_ERROR_OUT_OF_BOUNDS; attempt++) {
+            map.salt = attempt * 0x9E3779B97F4A7C15ULL;
+            u_stash_umap_visit(table, u_stash_fmap_hash_entry, &build);
+            ret = u_stash_fmap_place(&map, hashes);
+        }
+
+        if (ret == STASH_SUCCESS) {
+            u_stash_umap_visit(table, u_stash_fmap_store_entry, &build);
+        }
+    }
+
+    STASH_FREE(hashes);
+
+    if (ret < 0) {
+        stash_fmap_destroy(&map);
+        return ret;
+    }
+
+    *frozen = map;
+
+    return STASH_SUCCESS;
+}
+
+void stash_fmap_destroy(stash_fmap* map)
+{
+    if (!map) return;
+
+    stash_arr_destroy(&map->pilots);
+    stash_arr_destroy(&map->slots);
+    map->count = 0;
+}
+
+bool stash_fmap_is_valid(const stash_fmap* map)
+{
+    return map
+        && stash_arr_is_valid(&map->pilots)
+        && stash_arr_is_valid(&map->slots);
+}
+
+int stash_fmap_get(const stash_fmap* map, uint32_t key, void* element)
+{
+    if (!map || map->key_size != sizeof(uint32_t)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    return stash_fmap_get_key(map, &key, element);
+}
+
+const void* stash_fmap_find(const stash_fmap* map, uint32_t key)
+{
+    if (!map || map->key_size != sizeof(uint32_t)) return NULL;
+
+    return stash_fmap_find_key(map, &key);
+}
+
+bool stash_fmap_contains(const stash_fmap* map, uint32_t key)
+{
+    return stash_fmap_find(map, key) != NULL;
+}
+
+int stash_fmap_get_key(const stash_fmap* map, const void* key, void* element)
+{
+    if (!stash_fmap_is_valid(map) || !key || !element) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    const void* value = u_stash_fmap_lookup(map, key);
+    if (!value) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    memcpy(element, value, map->value_size);
+
+    return STASH_SUCCESS;
+}
+
+const void* stash_fmap_find_key(const stash_fmap* map, const void* key)
+{
+    if (!stash_fmap_is_valid(map) || !key) return NULL;
+
+    return u_stash_fmap_lookup(map, key);
+}
+
+bool stash_fmap_contains_key(const stash_fmap* map, const void* key)
+{
+    return stash_fmap_find_key(map, key) != NULL;
+}
+
+size_t stash_fmap_count(const stash_fmap* map)
+{
+    return stash_fmap_is_valid(map) ? map->count : 0;
+}
+
+/* === Private Set Implementation === */
+
+typedef struct {
+    stash_umap* out;            // Table receiving the keys
+    const stash_umap* probe;    // Keys are only taken if their presence in 'probe' equals 'present' (NULL takes all)
+    bool present;
+    stash_visit_fn visit;       // Callback of stash_uset_for_each
+    void* user;
+    int ret;                    // First error met
+} u_stash_uset_merge;
+
+static void u_stash_uset_merge_key(void* context, size_t index, const void* key, const void* value)
+{
+    u_stash_uset_merge* merge = (u_stash_uset_merge*)context;
+    (void)index;
+    (void)value;
+
+    if (merge->ret < 0) return;
+
+    if (merge->probe != NULL) {
+        const stash_umap* owner;
+        if ((u_stash_umap_lookup(merge->probe, key, &owner) >= 0) != merge->present) return;
+    }
+
+    void* slot;
+    int ret = u_stash_umap_emplace(merge->out, key, &slot);
+    if (ret < 0) merge->ret = ret;
+}
+
+static void u_stash_uset_erase_key(void* context, size_t index, const void* key, const void* value)
+{
+    u_stash_uset_merge* merge = (u_stash_uset_merge*)context;
+    (void)index;
+    (void)value;
+
+    stash_umap_remove_key(merge->out, key, NULL);
+}
+
+static void u_stash_uset_visit_key(void* context, size_t index, const void* key, const void* value)
+{
+    u_stash_uset_merge* merge = (u_stash_uset_merge*)context;
+    (void)index;
+    (void)value;
+
+    uint32_t k;
+    memcpy(&k, key, sizeof(k));
+    merge->visit(k, NULL, merge->user);
+}
+
+static int u_stash_uset_rebuild(stash_uset* set, const stash_umap* from, const stash_umap* probe, bool present)
+{
+    // Filtered keys go to a new table sized for 'from', which then replaces the set
+    stash_umap out = stash_umap_create_keyed(from->count, sizeof(uint32_t), 0, set->table.flags);
+    if (!stash_umap_is_valid(&out)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    // The set keeps its own hash and load factor, whichever table is walked
+    out.hash = set->table.hash;
+    out.seed = set->table.seed;
+    out.max_load_factor = set->table.max_load_factor;
+    u_stash_umap_update_growth_limit(&out);
+
+    u_stash_uset_merge merge = { 0 };
+    merge.out = &out;
+    merge.probe = probe;
+    merge.present = present;
+
+    merge.ret = stash_umap_reserve(&out, from->count);
+    if (merge.ret == STASH_SUCCESS) {
+        u_stash_umap_visit(from, u_stash_uset_merge_key, &merge);
+    }
+
+    if (merge.ret < 0) {
+        stash_umap_destroy(&out);
+        return merge.ret;
+    }
+
+    stash_umap_destroy(&set->table);
+    set->table = out;
+
+    return STASH_SUCCESS;
+}
+
+/* === Public Set Implementation === */
+
+stash_uset stash_uset_create(size_t initialCapacity)
+{
+    stash_uset set;
+    set.table = stash_umap_create_keyed(initialCapacity, sizeof(uint32_t), 0, STASH_UMAP_INLINE);
+    return set;
+}
+
+int stash_uset_reserve(stash_uset* set, size_t newCapacity)
+{
+    if (!set) return STASH_ERROR_OUT_OF_MEMORY;
+
+    return stash_umap_reserve(&set->table, newCapacity);
+}
+
+void stash_uset_destroy(stash_uset* set)
+{
+    if (!set) return;
+
+    stash_umap_destroy(&set->table);
+}
+
+bool stash_uset_is_valid(const stash_uset* set)
+{
+    return set && stash_umap_is_valid(&set->table);
+}
+
+int stash_uset_insert(stash_uset* set, uint32_t key)
+{
+    if (!stash_uset_is_valid(set)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    void* slot;
+    return u_stash_umap_emplace(&set->table, &key, &slot);
+}
+
+int stash_uset_remove(stash_uset* set, uint32_t key)
+{
+    if (!set) return STASH_ERROR_KEY_NOT_FOUND;
+
+    return stash_umap_remove_key(&set->table, &key, NULL);
+}
+
+bool stash_uset_contains(const stash_uset* set, uint32_t key)
+{
+    return set && stash_umap_contains_key(&set->table, &key);
+}
+
+size_t stash_uset_count(const stash_uset* set)
+{
+    return set ? stash_umap_count(&set->table) : 0;
+}
+
+void stash_uset_clear(stash_uset* set)
+{
+    if (!set) return;
+
+    stash_umap_clear(&set->table);
+}
+
+void stash_uset_for_each(const stash_uset* set, stash_visit_fn visit, void* user)
+{
+    if (!stash_uset_is_valid(set) || !visit) return;
+
+    u_stash_uset_merge merge = { 0 };
+    merge.visit = visit;
+    merge.user = user;
+
+    u_stash_umap_visit(&set->table, u_stash_uset_visit_key, &merge);
+}
+
+int stash_uset_union(stash_uset* set, const stash_uset* other)
+{
+    if (!stash_uset_is_valid(set) || !stash_uset_is_valid(other)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+    if (set == other) {
+        return STASH_SUCCESS;
+    }
+
+    u_stash_uset_merge merge = { 0 };
+    merge.out = &set->table;
+
+    u_stash_umap_visit(&other->table, u_stash_uset_merge_key, &merge);
+
+    return merge.ret;
+}
+
+int stash_uset_intersection(stash_uset* set, const stash_uset* other)
+{
+    if (!stash_uset_is_valid(set) || !stash_uset_is_valid(other)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+    if (set == other) {
+        return STASH_SUCCESS;
+    }
+
+    // The smaller set is walked, each of its keys is looked up in the larger one
+    if (other->table.count < set->table.count) {
+        return u_stash_uset_rebuild(set, &other->table, &set->table, true);
+    }
+
+    return u_stash_uset_rebuild(set, &set->table, &other->table, true);
+}
+
+int stash_uset_difference(stash_uset* set, const stash_uset* other)
+{
+    if (!stash_uset_is_valid(set) || !stash_uset_is_valid(other)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+    if (set == other) {
+        stash_uset_clear(set);
+        return STASH_SUCCESS;
+    }
+
+    // Removing the keys of a smaller 'other' is cheaper than rebuilding the set
+    if (other->table.count <= set->table.count) {
+        u_stash_uset_merge merge = { 0 };
+        merge.out = &set->table;
+
+        u_stash_umap_visit(&other->table, u_stash_uset_erase_key, &merge);
+        return STASH_SUCCESS;
+    }
+
+    return u_stash_uset_rebuild(set, &set->table, &other->table, false);
+}
+
+/* === Private Multimap Implementation === */
+
+typedef struct {
+    uint32_t offset;        // First value of the run in 'values'
+    uint32_t count;         // Values of the key
+    uint32_t capacity;      // Values the run can hold before it has to move
+} u_stash_umultimap_run;
+
+static inline void* u_stash_umultimap_value_at(const stash_umultimap* map, size_t index)
+{
+    return (char*)map->values.data + index * map->value_size;
+}
+
+static int u_stash_umultimap_compact(stash_umultimap* map)
+{
+    // Runs are packed back to back in a new array, with no spare room
+    stash_arr values = stash_arr_create(map->count > 16 ? map->count : 16, map->value_size);
+    if (!stash_arr_is_valid(&values)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    stash_umap* keys = &map->keys;
+
+    for (size_t i = 0; i < keys->buckets.count; i++) {
+        if (!u_stash_umap_is_full(keys, i)) continue;
+
+        void* slot = u_stash_umap_value_at(keys, i);
+        u_stash_umultimap_run run;
+        memcpy(&run, slot, sizeof(run));
+
+        memcpy((char*)values.data + values.count * map->value_size, u_stash_umultimap_value_at(map, run.offset), run.count * map->value_size);
+        run.offset = (uint32_t)values.count;
+        run.capacity = run.count;
+        values.count += run.count;
+
+        memcpy(slot, &run, sizeof(run));
+    }
+
+    stash_arr_destroy(&map->values);
+    map->values = values;
+    map->garbage = 0;
+
+    return STASH_SUCCESS;
+}
+
+static void u_stash_umultimap_release(stash_umultimap* map, const u_stash_umultimap_run* run)
+{
+    // A run at the end of the array is cut off, any other is left as garbage
+    if ((size_t)run->offset + run->capacity == map->values.count) {
+        map->values.count -= run->capacity;
+    }
+    else {
+        map->garbage += run->capacity;
+    }
+
+    // Reclaim the array once most of it is garbage
+    if (map->garbage >= 64 && map->garbage > map->values.count / 2) {
+        u_stash_umultimap_compact(map); //< On failure the garbage is simply kept
+    }
+}
+
+static int u_stash_umultimap_grow(stash_umultimap* map, u_stash_umultimap_run* run)
+{
+    // Runs double, starting from a single value since many keys only ever hold one
+    size_t capacity = run->capacity ? (size_t)run->capacity * 2 : 1;
+    bool at_end = (size_t)run->offset + run->capacity == map->values.count;
+    size_t offset = at_end ? run->offset : map->values.count;
+    size_t needed = offset + capacity;
+
+    if (needed > UINT32_MAX) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    if (needed > map->values.capacity) {
+        size_t grown = map->values.capacity * 2;
+        int ret = stash_arr_reserve(&map->values, (needed > grown) ? needed : grown);
+        if (ret < 0) return ret;
+    }
+
+    // A run at the end of the array grows in place, any other moves to the end
+    if (!at_end) {
+        memcpy(u_stash_umultimap_value_at(map, offset), u_stash_umultimap_value_at(map, run->offset), run->count * map->value_size);
+        map->garbage += run->capacity;
+        run->offset = (uint32_t)offset;
+    }
+
+    map->values.count = needed;
+    run->capacity = (uint32_t)capacity;
+
+    return STASH_SUCCESS;
+}
+
+/* === Public Multimap Implementation === */
+
+stash_umultimap stash_umultimap_create(size_t initialCapacity, size_t value_size)
+{
+    stash_umultimap map = { 0 };
+
+    if (value_size == 0) {
+        return map;
+    }
+
+    map.keys = stash_umap_create(initialCapacity, sizeof(u_stash_umultimap_run));
+    map.values = stash_arr_create(initialCapacity > 16 ? initialCapacity : 16, value_size);
+
+    if (!stash_umap_is_valid(&map.keys) || !stash_arr_is_valid(&map.values)) {
+        stash_umap_destroy(&map.keys);
+        stash_arr_destroy(&map.values);
+        return map;
+    }
+
+    map.value_size = value_size;
+
+    return map;
+}
+
+void stash_umultimap_destroy(stash_umultimap* map)
+{
+    if (!map) return;
+
+    stash_umap_destroy(&map->keys);
+    stash_arr_destroy(&map->values);
+    map->count = 0;
+    map->garbage = 0;
+    map->value_size = 0;
+}
+
+bool stash_umultimap_is_valid(const stash_umultimap* map)
+{
+    return map
+        && stash_umap_is_valid(&map->keys)
+        && stash_arr_is_valid(&map->values);
+}
+
+int stash_umultimap_insert(stash_umultimap* map, uint32_t key, const void* value)
+{
+    if (!stash_umultimap_is_valid(map) || !value) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    void* slot;
+    int ret = u_stash_umap_emplace(&map->keys, &key, &slot);
+    if (ret < 0) return ret;
+
+    // A new key starts with an empty run at the end of the array
+    u_stash_umultimap_run run = { 0 };
+    bool inserted = (ret == STASH_SUCCESS);
+
+    if (inserted) {
+        run.offset = (uint32_t)map->values.count;
+    }
+    else {
+        memcpy(&run, slot, sizeof(run));
+    }
+
+    if (run.count == run.capacity) {
+        ret = u_stash_umultimap_grow(map, &run);
+        if (ret < 0) {
+            if (inserted) stash_umap_remove_key(&map->keys, &key, NULL);
+            return ret;
+        }
+    }
+
+    memcpy(u_stash_umultimap_value_at(map, (size_t)run.offset + run.count), value, map->value_size);
+    run.count++;
+    map->count++;
+
+    memcpy(slot, &run, sizeof(run));
+
+    return STASH_SUCCESS;
+}
+
+int stash_umultimap_remove(stash_umultimap* map, uint32_t key)
+{
+    if (!stash_umultimap_is_valid(map)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    u_stash_umultimap_run run;
+    int ret = stash_umap_remove_key(&map->keys, &key, &run);
+    if (ret < 0) return ret;
+
+    map->count -= run.count;
+    u_stash_umultimap_release(map, &run);
+
+    return STASH_SUCCESS;
+}
+
+int stash_umultimap_remove_at(stash_umultimap* map, uint32_t key, size_t index, void* element)
+{
+    if (!stash_umultimap_is_valid(map)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    void* slot = stash_umap_find_key(&map->keys, &key);
+    if (!slot) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    u_stash_umultimap_run run;
+    memcpy(&run, slot, sizeof(run));
+
+    if (index >= run.count) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    char* values = (char*)u_stash_umultimap_value_at(map, run.offset);
+    size_t size = map->value_size;
+
+    if (element != NULL) {
+        memcpy(element, values + index * size, size);
+    }
+
+    // The following values move down, so the run keeps its insertion order
+    memmove(values + index * size, values + (index + 1) * size, (run.count - index - 1) * size);
+    run.count--;
+    map->count--;
+
+    // The key goes away with its last value
+    if (run.count == 0) {
+        stash_umap_remove_key(&map->keys, &key, NULL);
+        u_stash_umultimap_release(map, &run);
+    }
+    else {
+        memcpy(slot, &run, sizeof(run));
+    }
+
+    return STASH_SUCCESS;
+}
+
+void* stash_umultimap_equal_range(stash_umultimap* map, uint32_t key, size_t* count)
+{
+    return (void*)stash_umultimap_equal_range_const(map, key, count);
+}
+
+const void* stash_umultimap_equal_range_const(const stash_umultimap* map, uint32_t key, size_t* count)
+{
+    if (count != NULL) *count = 0;
+
+    if (!stash_umultimap_is_valid(map)) return NULL;
+
+    const void* slot = stash_umap_find_key_const(&map->keys, &key);
+    if (!slot) return NULL;
+
+    u_stash_umultimap_run run;
+    memcpy(&run, slot, sizeof(run));
+
+    if (count != NULL) *count = run.count;
+
+    return u_stash_umultimap_value_at(map, run.offset);
+}
+
+bool stash_umultimap_contains(const stash_umultimap* map, uint32_t key)
+{
+    return stash_umultimap_is_valid(map) && stash_umap_contains_key(&map->keys, &key);
+}
+
+size_t stash_umultimap_count(const stash_umultimap* map)
+{
+    return stash_umultimap_is_valid(map) ? map->count : 0;
+}
+
+size_t stash_umultimap_key_count(const stash_umultimap* map)
+{
+    return stash_umultimap_is_valid(map) ? stash_umap_count(&map->keys) : 0;
+}
+
+void stash_umultimap_clear(stash_umultimap* map)
+{
+    if (!stash_umultimap_is_valid(map)) return;
+
+    stash_umap_clear(&map->keys);
+    map->values.count = 0;
+    map->count = 0;
+    map->garbage = 0;
+}
+
+void stash_umultimap_for_each(stash_umultimap* map, stash_visit_fn visit, void* user)
+{
+    if (!stash_umultimap_is_valid(map) || !visit) return;
+
+    stash_umap* keys = &map->keys;
+
+    for (size_t i = 0; i < keys->buckets.count; i++) {
+        if (!u_stash_umap_is_full(keys, i)) continue;
+
+        uint32_t key;
+        u_stash_umultimap_run run;
+        memcpy(&key, u_stash_umap_key_at(keys, i), sizeof(key));
+        memcpy(&run, u_stash_umap_value_at(keys, i), sizeof(run));
+
+        for (size_t j = 0; j < run.count; j++) {
+            visit(key, u_stash_umultimap_value_at(map, (size_t)run.offset + j), user);
+        }
+    }
+}
+
+/* === Private String Table Implementation === */
+
+static inline uint64_t u_stash_smap_hash(const char* key, size_t len)
+{
+    // Zero marks empty slots, so it is never used as a key hash
+    uint64_t h = u_stash_hash_bytes(key, len, 0);
+    return h != 0 ? h : 1;
+}
+
+static inline stash_smap_slot* u_stash_smap_slot_at(const stash_smap* map, size_t index)
+{
+    return (stash_smap_slot*)((char*)map->buckets.data + index * map->buckets.elem_size);
+}
+
+static inline void* u_stash_smap_value_at(const stash_smap* map, size_t index)
+{
+    return (char*)u_stash_smap_slot_at(map, index) + map->value_offset;
+}
+
+static inline const char* u_stash_smap_key_of(const stash_smap* map, const stash_smap_slot* slot)
+{
+    return (slot->len <= STASH_SMAP_INLINE_KEY) ? slot->key : (const char*)map->arena.data + slot->offset;
+}
+
+static inline size_t u_stash_smap_dist(const stash_smap* map, size_t index, uint64_t hash)
+{
+    // Distance from the home bucket, recovered from the cached hash
+    return (index - (size_t)hash) & (map->buckets.count - 1);
+}
+
+static inline size_t u_stash_smap_buckets_for(size_t count)
+{
+    size_t min_count = (size_t)((double)count / STASH_UMAP_MAX_LOAD_FACTOR) + 1;
+    size_t bucket_count = (size_t)u_stash_ceil_po2_u64((int64_t)min_count);
+    return (bucket_count < 16) ? 16 : bucket_count;
+}
+
+static inline void u_stash_smap_update_growth_limit(stash_smap* map)
+{
+    map->growth_limit = (size_t)((double)map->buckets.count * STASH_UMAP_MAX_LOAD_FACTOR);
+    if (map->growth_limit >= map->buckets.count) {
+        map->growth_limit = map->buckets.count - 1; //< Always keep a free slot
+    }
+}
+
+static int64_t u_stash_smap_probe(const stash_smap* map, const char* key, size_t len, uint64_t hash, size_t* pos)
+{
+    // Robin Hood probe, returns the index of the key or -1 with its insertion point in 'pos'
+
+    size_t mask = map->buckets.count - 1;
+    size_t index = (size_t)hash & mask;
+
+    for (size_t dist = 0;; dist++, index = (index + 1) & mask) {
+        const stash_smap_slot* slot = u_stash_smap_slot_at(map, index);
+
+        // The key would have displaced any entry closer to its home
+        if (slot->hash == 0 || u_stash_smap_dist(map, index, slot->hash) < dist) {
+            *pos = index;
+            return -1;
+        }
+
+        // The cached hash rejects nearly every mismatch without touching the key bytes
+        if (slot->hash == hash && slot->len == len && memcmp(u_stash_smap_key_of(map, slot), key, len) == 0) {
+            return (int64_t)index;
+        }
+    }
+}
+
+static void u_stash_smap_make_room(stash_smap* map, size_t pos)
+{
+    // Shifts the run starting at 'pos' one slot to the right, up to the next empty slot
+
+    size_t mask = map->buckets.count - 1;
+    size_t empty = pos;
+
+    while (u_stash_smap_slot_at(map, empty)->hash != 0) {
+        empty = (empty + 1) & mask;
+    }
+
+    while (empty != pos) {
+        size_t prev = (empty - 1) & mask;
+        memcpy(u_stash_smap_slot_at(map, empty), u_stash_smap_slot_at(map, prev), map->buckets.elem_size);
+        empty = prev;
+    }
+}
+
+static void u_stash_smap_erase_at(stash_smap* map, size_t index)
+{
+    // Backward shift deletion, no tombstones
+
+    size_t mask = map->buckets.count - 1;
+    size_t next = (index + 1) & mask;
+
+    for (;;) {
+        const stash_smap_slot* slot = u_stash_smap_slot_at(map, next);
+        if (slot->hash == 0 || u_stash_smap_dist(map, next, slot->hash) == 0) {
+            break;
+        }
+        memcpy(u_stash_smap_slot_at(map, index), slot, map->buckets.elem_size);
+        index = next;
+        next = (next + 1) & mask;
+    }
+
+    u_stash_smap_slot_at(map, index)->hash = 0;
+}
+
+static int u_stash_smap_arena_push(stash_smap* map, const char* key, size_t len, uint32_t* offset)
+{
+    size_t size = map->arena.count + len + 1;
+    if (size > UINT32_MAX) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (size > map->arena.capacity) {
+        // The key may itself point into the arena
+        uintptr_t base = (uintptr_t)map->arena.data;
+        bool inside = (uintptr_t)key >= base && (uintptr_t)key < base + map->arena.count;
+        size_t key_offset = (size_t)((uintptr_t)key - base);
+
+        int ret = stash_arr_reserve(&map->arena, (size_t)u_stash_ceil_po2_u64((int64_t)size));
+        if (ret < 0) return ret;
+
+        if (inside) key = (const char*)map->arena.data + key_offset;
+    }
+
+    char* dst = (char*)map->arena.data + map->arena.count;
+    memcpy(dst, key, len);
+    dst[len] = '\0';
+
+    *offset = (uint32_t)map->arena.count;
+    map->arena.count = size;
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_smap_compact_arena(stash_smap* map)
+{
+    size_t live = map->arena.count - map->arena_garbage;
+
+    stash_arr arena = stash_arr_create(live > 64 ? live : 64, sizeof(char));
+    if (!stash_arr_is_valid(&arena)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    for (size_t i = 0; i < map->buckets.count; i++) {
+        stash_smap_slot* slot = u_stash_smap_slot_at(map, i);
+        if (slot->hash == 0 || slot->len <= STASH_SMAP_INLINE_KEY) {
+            continue;
+        }
+        memcpy((char*)arena.data + arena.count, (const char*)map->arena.data + slot->offset, slot->len + 1);
+        slot->offset = (uint32_t)arena.count;
+        arena.count += slot->len + 1;
+    }
+
+    stash_arr_destroy(&map->arena);
+    map->arena = arena;
+    map->arena_garbage = 0;
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_smap_rebuild(stash_smap* map, size_t bucket_count)
+{
+    stash_arr buckets = stash_arr_create(bucket_count, map->buckets.elem_size);
+    if (!stash_arr_is_valid(&buckets)) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    buckets.count = bucket_count;
+    memset(buckets.data, 0, bucket_count * buckets.elem_size);
+
+    stash_arr prev = map->buckets;
+    map->buckets = buckets;
+
+    // Keys stay where they are in the arena, only the slots move
+    for (size_t i = 0; i < prev.count; i++) {
+        const stash_smap_slot* slot = (const stash_smap_slot*)((char*)prev.data + i * prev.elem_size);
+        if (slot->hash == 0) continue;
+
+        size_t pos;
+        u_stash_smap_probe(map, u_stash_smap_key_of(map, slot), slot->len, slot->hash, &pos);
+        u_stash_smap_make_room(map, pos);
+        memcpy(u_stash_smap_slot_at(map, pos), slot, prev.elem_size);
+    }
+
+    stash_arr_destroy(&prev);
+    u_stash_smap_update_growth_limit(map);
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_smap_emplace(stash_smap* map, const char* key, size_t len, void** value)
+{
+    if (len >= UINT32_MAX) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (key == NULL) key = ""; //< The empty key may be passed as NULL, never handed to memcpy
+
+    uint64_t hash = u_stash_smap_hash(key, len);
+
+    size_t pos;
+    int64_t index = u_stash_smap_probe(map, key, len, hash, &pos);
+    if (index >= 0) {
+        *value = u_stash_smap_value_at(map, (size_t)index);
+        return STASH_KEY_EXISTS;
+    }
+
+    if (map->count >= map->growth_limit) {
+        int ret = u_stash_smap_rebuild(map, map->buckets.count * 2);
+        if (ret < 0) return ret;
+        u_stash_smap_probe(map, key, len, hash, &pos);
+    }
+
+    stash_smap_slot header = { 0 };
+    header.hash = hash;
+    header.len = (uint32_t)len;
+
+    if (len <= STASH_SMAP_INLINE_KEY) {
+        memcpy(header.key, key, len);
+    }
+    else {
+        int ret = u_stash_smap_arena_push(map, key, len, &header.offset);
+        if (ret < 0) return ret;
+    }
+
+    u_stash_smap_make_room(map, pos);
+    memcpy(u_stash_smap_slot_at(map, pos), &header, sizeof(header));
+    map->count++;
+
+    *value = u_stash_smap_value_at(map, pos);
+
+    return STASH_SUCCESS;
+}
+
+static int64_t u_stash_smap_scan(const stash_smap* map, int64_t index, int64_t step)
+{
+    // Next occupied slot from 'index' (inclusive) in the direction of 'step', or -1
+    for (; index >= 0 && (size_t)index < map->buckets.count; index += step) {
+        if (u_stash_smap_slot_at(map, (size_t)index)->hash != 0) {
+            return index;
+        }
+    }
+    return -1;
+}
+
+/* === Public String Table Implementation === */
+
+stash_smap stash_smap_create(size_t initialCapacity, size_t value_size)
+{
+    stash_smap map = { 0 };
+    map.value_size = value_size;
+
+    // Values follow the slot header, aligned like stash_umap inline values
+    size_t align = value_size & (~value_size + 1);
+    if (align == 0 || align > STASH_MAX_ALIGN) align = STASH_MAX_ALIGN;
+    if (align < sizeof(uint64_t)) align = sizeof(uint64_t); //< Keeps the cached hashes aligned
+
+    map.value_offset = (sizeof(stash_smap_slot) + align - 1) & ~(align - 1);
+    size_t stride = (map.value_offset + value_size + align - 1) & ~(align - 1);
+
+    size_t bucket_count = u_stash_smap_buckets_for(initialCapacity);
+
+    map.buckets = stash_arr_create(bucket_count, stride);
+    map.arena = stash_arr_create(64, sizeof(char));
+
+    if (!stash_arr_is_valid(&map.buckets) || !stash_arr_is_valid(&map.arena)) {
+        stash_arr_destroy(&map.buckets);
+        stash_arr_destroy(&map.arena);
+        return (stash_smap) { 0 };
+    }
+
+    map.buckets.count = bucket_count;
+    memset(map.buckets.data, 0, bucket_count * stride);
+    u_stash_smap_update_growth_limit(&map);
+
+    return map;
+}
+
+int stash_smap_reserve(stash_smap* map, size_t newCapacity)
+{
+    if (!stash_smap_is_valid(map) || newCapacity < map->count) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (newCapacity <= map->growth_limit) {
+        return STASH_SUCCESS;
+    }
+
+    return u_stash_smap_rebuild(map, u_stash_smap_buckets_for(newCapacity));
+}
+
+void stash_smap_destroy(stash_smap* map)
+{
+    if (!stash_smap_is_valid(map)) {
+        return;
+    }
+
+    stash_arr_destroy(&map->buckets);
+    stash_arr_destroy(&map->arena);
+
+    map->arena_garbage = 0;
+    map->count = 0;
+    map->value_size = 0;
+    map->value_offset = 0;
+    map->growth_limit = 0;
+}
+
+bool stash_smap_is_valid(const stash_smap* map)
+{
+    return map
+        && stash_arr_is_valid(&map->buckets)
+        && stash_arr_is_valid(&map->arena);
+}
+
+bool stash_smap_is_empty(const stash_smap* map)
+{
+    return !stash_smap_is_valid(map) || map->count == 0;
+}
+
+stash_it stash_smap_begin(stash_smap* map)
+{
+    stash_it it = { 0 };
+
+    if (!stash_smap_is_valid(map) || map->count == 0) {
+        return it;
+    }
+
+    // The index of the current slot is stored in 'prev', as for stash_umap
+    int64_t first = u_stash_smap_scan(map, 0, 1);
+    int64_t second = u_stash_smap_scan(map, first + 1, 1);
+
+    it.curr = u_stash_smap_value_at(map, (size_t)first);
+    it.prev = (void*)(uintptr_t)first;
+    it.next = (second >= 0) ? u_stash_smap_value_at(map, (size_t)second) : NULL;
+
+    return it;
+}
+
+void stash_smap_previous(stash_smap* map, stash_it* it)
+{
+    if (!stash_smap_is_valid(map) || !it || map->count == 0) {
+        return;
+    }
+
+    // Before the start we stay there, after the end we go back to the last element
+    if (it->curr == NULL) {
+        if (it->next == NULL) *it = stash_smap_end(map);
+        return;
+    }
+
+    int64_t prev = u_stash_smap_scan(map, (int64_t)(uintptr_t)it->prev - 1, -1);
+
+    it->next = it->curr;
+    it->curr = (prev >= 0) ? u_stash_smap_value_at(map, (size_t)prev) : NULL;
+    it->prev = (prev >= 0) ? (void*)(uintptr_t)prev : NULL;
+}
+
+void stash_smap_next(stash_smap* map, stash_it* it)
+{
+    if (!stash_smap_is_valid(map) || !it || map->count == 0) {
+        return;
+    }
+
+    // After the end we stay there, before the start we go to the first element
+    if (it->curr == NULL) {
+        if (it->prev == NULL) *it = stash_smap_begin(map);
+        return;
+    }
+
+    if (it->next == NULL) {
+        it->prev = it->curr;
+        it->curr = NULL;
+        return;
+    }
+
+    int64_t next = u_stash_smap_scan(map, (int64_t)(uintptr_t)it->prev + 1, 1);
+    int64_t after = u_stash_smap_scan(map, next + 1, 1);
+
+    it->curr = u_stash_smap_value_at(map, (size_t)next);
+    it->prev = (void*)(uintptr_t)next;
+    it->next = (after >= 0) ? u_stash_smap_value_at(map, (size_t)after) : NULL;
+}
+
+stash_it stash_smap_end(stash_smap* map)
+{
+    stash_it it = { 0 };
+
+    if (!stash_smap_is_valid(map) || map->count == 0) {
+        return it;
+    }
+
+    int64_t last = u_stash_smap_scan(map, (int64_t)map->buckets.count - 1, -1);
+
+    it.curr = u_stash_smap_value_at(map, (size_t)last);
+    it.prev = (void*)(uintptr_t)last;
+
+    return it;
+}
+
+const char* stash_smap_key(const stash_smap* map, const stash_it* it, size_t* len)
+{
+    if (!stash_smap_is_valid(map) || !it || it->curr == NULL) {
+        return NULL;
+    }
+
+    const stash_smap_slot* slot = u_stash_smap_slot_at(map, (size_t)(uintptr_t)it->prev);
+    if (len != NULL) *len = slot->len;
+
+    return u_stash_smap_key_of(map, slot);
+}
+
+int stash_smap_insert(stash_smap* map, const char* key, size_t len, const void* value)
+{
+    if (!stash_smap_is_valid(map) || (!key && len > 0) || !value) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    void* slot;
+    int ret = u_stash_smap_emplace(map, key, len, &slot);
+
+    // Copy the value only if the key was not already present
+    if (ret == STASH_SUCCESS) {
+        memcpy(slot, value, map->value_size);
+    }
+
+    return ret;
+}
+
+void* stash_smap_emplace(stash_smap* map, const char* key, size_t len, bool* inserted)
+{
+    if (!stash_smap_is_valid(map) || (!key && len > 0)) {
+        return NULL;
+    }
+
+    void* slot;
+    int ret = u_stash_smap_emplace(map, key, len, &slot);
+    if (ret < 0) return NULL;
+
+    if (ret == STASH_SUCCESS) {
+        memset(slot, 0, map->value_size);
+    }
+
+    if (inserted != NULL) {
+        *inserted = (ret == STASH_SUCCESS);
+    }
+
+    return slot;
+}
+
+int stash_smap_remove(stash_smap* map, const char* key, size_t len, void* element)
+{
+    if (!stash_smap_is_valid(map) || (!key && len > 0)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    if (key == NULL) key = "";
+
+    size_t pos;
+    int64_t index = u_stash_smap_probe(map, key, len, u_stash_smap_hash(key, len), &pos);
+    if (index < 0) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    if (element != NULL) {
+        memcpy(element, u_stash_smap_value_at(map, (size_t)index), map->value_size);
+    }
+
+    if (len > STASH_SMAP_INLINE_KEY) {
+        map->arena_garbage += len + 1;
+    }
+
+    u_stash_smap_erase_at(map, (size_t)index);
+    map->count--;
+
+    // Reclaim the arena once most of it belongs to removed keys
+    if (map->arena_garbage >= 4096 && map->arena_garbage > map->arena.count / 2) {
+        u_stash_smap_compact_arena(map); //< On failure the garbage is simply kept
+    }
+
+    return STASH_SUCCESS;
+}
+
+int stash_smap_get(const stash_smap* map, const char* key, size_t len, void* element)
+{
+    if (!stash_smap_is_valid(map) || (!key && len > 0) || !element) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    const void* value = stash_smap_find_const(map, key, len);
+    if (value == NULL) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    memcpy(element, value, map->value_size);
+
+    return STASH_SUCCESS;
+}
+
+void* stash_smap_find(stash_smap* map, const char* key, size_t len)
+{
+    return (void*)stash_smap_find_const(map, key, len);
+}
+
+const void* stash_smap_find_const(const stash_smap* map, const char* key, size_t len)
+{
+    if (!stash_smap_is_valid(map) || (!key && len > 0)) {
+        return NULL;
+    }
+
+    if (key == NULL) key = "";
+
+    size_t pos;
+    int64_t index = u_stash_smap_probe(map, key, len, u_stash_smap_hash(key, len), &pos);
+
+    return (index >= 0) ? u_stash_smap_value_at(map, (size_t)index) : NULL;
+}
+
+bool stash_smap_contains(const stash_smap* map, const char* key, size_t len)
+{
+    return stash_smap_find_const(map, key, len) != NULL;
+}
+
+void stash_smap_clear(stash_smap* map)
+{
+    if (!stash_smap_is_valid(map)) {
+        return;
+    }
+
+    memset(map->buckets.data, 0, map->buckets.count * map->buckets.elem_size);
+
+    map->arena.count = 0;
+    map->arena_garbage = 0;
+    map->count = 0;
+}
+
+size_t stash_smap_count(const stash_smap* map)
+{
+    return stash_smap_is_valid(map) ? map->count : 0;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/* === Private Concurrent Table Implementation === */
+
+#define U_STASH_CMAP_STRIPE_SHIFT 6   // Buckets covered by one sequence counter (log2)
+
+static inline size_t u_stash_cmap_home(const stash_cmap_table* table, uint32_t key)
+{
+    return (size_t)stash_hash_mix(&key, sizeof(key), 0) & table->mask;
+}
+
+static inline void* u_stash_cmap_value_at(const stash_cmap_table* table, size_t index)
+{
+    return (char*)table->values.data + index * table->values.elem_size;
+}
+
+static inline uint64_t* u_stash_cmap_stripe_at(const stash_cmap_table* table, size_t index)
+{
+    return (uint64_t*)(table->stripes + (index & table->stripe_mask) * STASH_CACHE_LINE);
+}
+
+static stash_cmap_table* u_stash_cmap_table_create(size_t bucket_count, size_t value_size)
+{
+    stash_cmap_table* table = (stash_cmap_table*)STASH_MALLOC(sizeof(stash_cmap_table));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    // Values are copied with atomic 8-byte words, so each one starts on a word
+    size_t value_stride = (value_size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+    size_t stripe_count = (bucket_count >> U_STASH_CMAP_STRIPE_SHIFT) ? bucket_count >> U_STASH_CMAP_STRIPE_SHIFT : 1;
+
+    table->mask = bucket_count - 1;
+    table->keys = stash_arr_create(bucket_count, sizeof(uint32_t));
+    table->used = stash_arr_create(bucket_count, sizeof(uint8_t));
+    table->values = stash_arr_create(bucket_count, value_stride ? value_stride : sizeof(uint64_t));
+    table->stripe_mask = stripe_count - 1;
+    table->stripe_memory = STASH_MALLOC(stripe_count * STASH_CACHE_LINE + STASH_CACHE_LINE - 1);
+    table->retired = NULL;
+
+    if (!stash_arr_is_valid(&table->keys) || !stash_arr_is_valid(&table->used) || !stash_arr_is_valid(&table->values)
+        || table->stripe_memory == NULL) {
+        stash_arr_destroy(&table->keys);
+        stash_arr_destroy(&table->used);
+        stash_arr_destroy(&table->values);
+        if (table->stripe_memory) STASH_FREE(table->stripe_memory);
+        STASH_FREE(table);
+        return NULL;
+    }
+
+    // Every counter sits on its own cache line, a write only invalidates the readers of its stripes
+    table->stripes = (char*)(((uintptr_t)table->stripe_memory + STASH_CACHE_LINE - 1) & ~(uintptr_t)(STASH_CACHE_LINE - 1));
+    memset(table->stripes, 0, stripe_count * STASH_CACHE_LINE);
+
+    table->keys.count = bucket_count;
+    table->used.count = bucket_count;
+    table->values.count = bucket_count;
+    memset(table->used.data, 0, bucket_count);
+
+    return table;
+}
+
+static void u_stash_cmap_table_destroy(stash_cmap_table* table)
+{
+    stash_arr_destroy(&table->keys);
+    stash_arr_destroy(&table->used);
+    stash_arr_destroy(&table->values);
+    STASH_FREE(table->stripe_memory);
+    STASH_FREE(table);
+}
+
+static void u_stash_cmap_load_value(const stash_cmap_table* table, size_t index, void* element, size_t size)
+{
+    // Relaxed word loads, a copy torn by a concurrent write is rejected by the stripe check
+    const uint64_t* words = (const uint64_t*)u_stash_cmap_value_at(table, index);
+
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word = __atomic_load_n(&words[i / sizeof(uint64_t)], __ATOMIC_RELAXED);
+        memcpy((char*)element + i, &word, (size - i < sizeof(uint64_t)) ? size - i : sizeof(uint64_t));
+    }
+}
+
+static void u_stash_cmap_store_value(stash_cmap_table* table, size_t index, const void* value, size_t size)
+{
+    uint64_t* words = (uint64_t*)u_stash_cmap_value_at(table, index);
+
+    for (size_t i = 0; i < size; i += sizeof(uint64_t)) {
+        uint64_t word = 0;
+        memcpy(&word, (const char*)value + i, (size - i < sizeof(uint64_t)) ? size - i : sizeof(uint64_t));
+        __atomic_store_n(&words[i / sizeof(uint64_t)], word, __ATOMIC_RELAXED);
+    }
+}
+
+static int64_t u_stash_cmap_probe(const stash_cmap_table* table, uint32_t key, size_t* pos)
+{
+    // Linear probe of the writer, returns the index of the key or -1 with the first free slot in 'pos'
+
+    const uint32_t* keys = (const uint32_t*)table->keys.data;
+    const uint8_t* used = (const uint8_t*)table->used.data;
+    size_t index = u_stash_cmap_home(table, key);
+
+    for (;;) {
+        if (!used[index]) {
+            *pos = index;
+            return -1;
+        }
+        if (keys[index] == key) {
+            return (int64_t)index;
+        }
+        index = (index + 1) & table->mask;
+    }
+}
+
+static inline uint64_t u_stash_cmap_stripe_enter(const stash_cmap_table* table, size_t stripe)
+{
+    // Waits out a write in progress on the stripe, its buckets are then read after the counter
+    uint64_t seq;
+    while ((seq = __atomic_load_n(u_stash_cmap_stripe_at(table, stripe), __ATOMIC_ACQUIRE)) & 1) {
+    }
+    return seq;
+}
+
+static int64_t u_stash_cmap_read(const stash_cmap* map, uint32_t key, void* element)
+{
+    // Lookup of a reader, copies the value to 'element' if not NULL. The counters of every
+    // stripe the probe crossed are added up on the way and again at the end: they only ever
+    // grow, so an equal sum means that no write touched the buckets that were read.
+
+    for (;;) {
+        const stash_cmap_table* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+        const uint32_t* keys = (const uint32_t*)table->keys.data;
+        const uint8_t* used = (const uint8_t*)table->used.data;
+
+        size_t index = u_stash_cmap_home(table, key);
+        size_t stripe = index >> U_STASH_CMAP_STRIPE_SHIFT;
+        size_t first = stripe, crossed = 1;
+        uint64_t sum = u_stash_cmap_stripe_enter(table, stripe);
+        int64_t found = -1;
+
+        // Bounded by the bucket count since the buckets may change under the probe
+        for (size_t i = 0; i <= table->mask; i++, index = (index + 1) & table->mask) {
+            if ((index >> U_STASH_CMAP_STRIPE_SHIFT) != stripe) {
+                stripe = index >> U_STASH_CMAP_STRIPE_SHIFT;
+                sum += u_stash_cmap_stripe_enter(table, stripe);
+                crossed++;
+            }
+
+            if (!__atomic_load_n(&used[index], __ATOMIC_RELAXED)) {
+                break;
+            }
+            if (__atomic_load_n(&keys[index], __ATOMIC_RELAXED) == key) {
+                found = (int64_t)index;
+                if (element != NULL) u_stash_cmap_load_value(table, index, element, map->value_size);
+                break;
+            }
+        }
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        uint64_t check = 0;
+        for (size_t s = 0; s < crossed; s++) {
+            check += __atomic_load_n(u_stash_cmap_stripe_at(table, first + s), __ATOMIC_RELAXED);
+        }
+
+        if (check == sum) {
+            return found;
+        }
+    }
+}
+
+static size_t u_stash_cmap_stripes_of(const stash_cmap_table* table, size_t first, size_t last)
+{
+    // Stripes covered by the buckets 'first' to 'last', which may wrap around
+    size_t span = (first & (((size_t)1 << U_STASH_CMAP_STRIPE_SHIFT) - 1)) + ((last - first) & table->mask);
+    size_t count = (span >> U_STASH_CMAP_STRIPE_SHIFT) + 1;
+
+    return (count > table->stripe_mask + 1) ? table->stripe_mask + 1 : count;
+}
+
+static void u_stash_cmap_write_begin(stash_cmap_table* table, size_t first, size_t last)
+{
+    // Odd counters: readers crossing these stripes wait, or retry if they already read them
+    size_t stripe = first >> U_STASH_CMAP_STRIPE_SHIFT;
+
+    for (size_t s = 0, n = u_stash_cmap_stripes_of(table, first, last); s < n; s++) {
+        uint64_t* seq = u_stash_cmap_stripe_at(table, stripe + s);
+        __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void u_stash_cmap_write_end(stash_cmap_table* table, size_t first, size_t last)
+{
+    size_t stripe = first >> U_STASH_CMAP_STRIPE_SHIFT;
+
+    for (size_t s = 0, n = u_stash_cmap_stripes_of(table, first, last); s < n; s++) {
+        uint64_t* seq = u_stash_cmap_stripe_at(table, stripe + s);
+        __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static int u_stash_cmap_grow(stash_cmap* map)
+{
+    // The larger table is filled privately, then published with a single pointer swap.
+    // Readers still walking the old one see a consistent, unmodified snapshot.
+
+    stash_cmap_table* old = map->table;
+    stash_cmap_table* table = u_stash_cmap_table_create((old->mask + 1) * 2, map->value_size);
+    if (table == NULL) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    const uint32_t* keys = (const uint32_t*)old->keys.data;
+    const uint8_t* used = (const uint8_t*)old->used.data;
+
+    for (size_t i = 0; i <= old->mask; i++) {
+        if (!used[i]) continue;
+
+        size_t pos;
+        u_stash_cmap_probe(table, keys[i], &pos);
+
+        ((uint32_t*)table->keys.data)[pos] = keys[i];
+        ((uint8_t*)table->used.data)[pos] = 1;
+        memcpy(u_stash_cmap_value_at(table, pos), u_stash_cmap_value_at(old, i), map->value_size);
+    }
+
+    // The old arrays stay readable until stash_cmap_reclaim() or stash_cmap_destroy()
+    table->retired = old;
+
+    __atomic_store_n(&map->table, table, __ATOMIC_RELEASE);
+    map->growth_limit = (size_t)((double)(table->mask + 1) * STASH_UMAP_MAX_LOAD_FACTOR);
+
+    return STASH_SUCCESS;
+}
+
+static int u_stash_cmap_write(stash_cmap* map, uint32_t key, const void* value, bool overwrite)
+{
+    size_t pos;
+    int64_t index = u_stash_cmap_probe(map->table, key, &pos);
+
+    if (index >= 0) {
+        if (overwrite) {
+            u_stash_cmap_write_begin(map->table, (size_t)index, (size_t)index);
+            u_stash_cmap_store_value(map->table, (size_t)index, value, map->value_size);
+            u_stash_cmap_write_end(map->table, (size_t)index, (size_t)index);
+        }
+        return STASH_KEY_EXISTS;
+    }
+
+    if (map->count + 1 > map->growth_limit) {
+        int ret = u_stash_cmap_grow(map);
+        if (ret < 0) return ret;
+        u_stash_cmap_probe(map->table, key, &pos);
+    }
+
+    stash_cmap_table* table = map->table;
+
+    u_stash_cmap_write_begin(table, pos, pos);
+    u_stash_cmap_store_value(table, pos, value, map->value_size);
+    __atomic_store_n(&((uint32_t*)table->keys.data)[pos], key, __ATOMIC_RELAXED);
+    __atomic_store_n(&((uint8_t*)table->used.data)[pos], 1, __ATOMIC_RELAXED);
+    u_stash_cmap_write_end(table, pos, pos);
+
+    __atomic_store_n(&map->count, map->count + 1, __ATOMIC_RELAXED);
+
+    return STASH_SUCCESS;
+}
+
+/* === Public Concurrent Table Implementation === */
+
+stash_cmap stash_cmap_create(size_t initialCapacity, size_t value_size)
+{
+    stash_cmap map = { 0 };
+
+    size_t bucket_count = (size_t)u_stash_ceil_po2_u64((int64_t)((double)initialCapacity / STASH_UMAP_MAX_LOAD_FACTOR) + 1);
+    if (bucket_count < 16) bucket_count = 16;
+
+    map.table = u_stash_cmap_table_create(bucket_count, value_size);
+    if (map.table == NULL) {
+        return map;
+    }
+
+    map.value_size = value_size;
+    map.growth_limit = (size_t)((double)bucket_count * STASH_UMAP_MAX_LOAD_FACTOR);
+
+    return map;
+}
+
+void stash_cmap_destroy(stash_cmap* map)
+{
+    if (!stash_cmap_is_valid(map)) {
+        return;
+    }
+
+    stash_cmap_table* table = map->table;
+    while (table != NULL) {
+        stash_cmap_table* retired = table->retired;
+        u_stash_cmap_table_destroy(table);
+        table = retired;
+    }
+
+    map->table = NULL;
+    map->count = 0;
+    map->value_size = 0;
+    map->growth_limit = 0;
+}
+
+bool stash_cmap_is_valid(const stash_cmap* map)
+{
+    // Readers call this while the writer may swap the table
+    return map && __atomic_load_n(&map->table, __ATOMIC_RELAXED) != NULL;
+}
+
+void stash_cmap_reclaim(stash_cmap* map)
+{
+    if (!stash_cmap_is_valid(map)) {
+        return;
+    }
+
+    stash_cmap_table* table = map->table->retired;
+    while (table != NULL) {
+        stash_cmap_table* retired = table->retired;
+        u_stash_cmap_table_destroy(table);
+        table = retired;
+    }
+
+    map->table->retired = NULL;
+}
+
+int stash_cmap_insert(stash_cmap* map, uint32_t key, const void* value)
+{
+    if (!stash_cmap_is_valid(map) || !value) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    return u_stash_cmap_write(map, key, value, false);
+}
+
+int stash_cmap_set(stash_cmap* map, uint32_t key, const void* value)
+{
+    if (!stash_cmap_is_valid(map) || !value) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    return u_stash_cmap_write(map, key, value, true);
+}
+
+int stash_cmap_remove(stash_cmap* map, uint32_t key, void* element)
+{
+    if (!stash_cmap_is_valid(map)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    stash_cmap_table* table = map->table;
+
+    size_t pos;
+    int64_t index = u_stash_cmap_probe(table, key, &pos);
+    if (index < 0) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    if (element != NULL) {
+        memcpy(element, u_stash_cmap_value_at(table, (size_t)index), map->value_size);
+    }
+
+    uint32_t* keys = (uint32_t*)table->keys.data;
+    uint8_t* used = (uint8_t*)table->used.data;
+
+    // The shift below may move any entry up to the end of the run
+    size_t end = (size_t)index;
+    while (used[(end + 1) & table->mask]) {
+        end = (end + 1) & table->mask;
+    }
+
+    u_stash_cmap_write_begin(table, (size_t)index, end);
+
+    // Backward shift deletion, moves back the entries whose probe sequence crosses the hole
+    size_t hole = (size_t)index;
+    for (size_t next = (hole + 1) & table->mask; used[next]; next = (next + 1) & table->mask) {
+        size_t home = u_stash_cmap_home(table, keys[next]);
+        if (((next - home) & table->mask) >= ((next - hole) & table->mask)) {
+            __atomic_store_n(&keys[hole], keys[next], __ATOMIC_RELAXED);
+            u_stash_cmap_store_value(table, hole, u_stash_cmap_value_at(table, next), map->value_size);
+            hole = next;
+        }
+    }
+    __atomic_store_n(&used[hole], 0, __ATOMIC_RELAXED);
+
+    u_stash_cmap_write_end(table, (size_t)index, end);
+
+    __atomic_store_n(&map->count, map->count - 1, __ATOMIC_RELAXED);
+
+    return STASH_SUCCESS;
+}
+
+int stash_cmap_get(const stash_cmap* map, uint32_t key, void* element)
+{
+    if (!stash_cmap_is_valid(map) || !element) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    return (u_stash_cmap_read(map, key, element) >= 0) ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND;
+}
+
+bool stash_cmap_contains(const stash_cmap* map, uint32_t key)
+{
+    if (!stash_cmap_is_valid(map)) {
+        return false;
+    }
+
+    return u_stash_cmap_read(map, key, NULL) >= 0;
+}
+
+size_t stash_cmap_count(const stash_cmap* map)
+{
+    return stash_cmap_is_valid(map) ? __atomic_load_n(&map->count, __ATOMIC_RELAXED) : 0;
+}
+
+#endif // __GNUC__ || __clang__
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/* === Private Sharded Table Implementation === */
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define U_STASH_CPU_RELAX() __builtin_ia32_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#   define U_STASH_CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#   define U_STASH_CPU_RELAX() ((void)0)
+#endif
+
+static inline void u_stash_spin_lock(uint32_t* lock)
+{
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        // Wait on a plain load so that the cache line is not bounced between waiters
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+            U_STASH_CPU_RELAX();
+        }
+    }
+}
+
+static inline void u_stash_spin_unlock(uint32_t* lock)
+{
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static inline stash_shmap_shard* u_stash_shmap_shard_at(const stash_shmap* map, size_t index)
+{
+    return (stash_shmap_shard*)(map->shards + index * map->shard_stride);
+}
+
+static inline stash_shmap_shard* u_stash_shmap_shard_of(const stash_shmap* map, uint32_t key)
+{
+    // The table hash is remixed with a fixed finalizer: used as is, a weak hash
+    // (e.g. stash_hash_identity, whose upper half is the key again) would pick
+    // the shard with the same key bits that pick the bucket inside the shard
+    uint64_t hash = u_stash_hash_u64(STASH_UMAP_HASH(&key, sizeof(key), 0));
+    return u_stash_shmap_shard_at(map, (size_t)(hash >> 32) & (map->shard_count - 1));
+}
+
+/* === Public Sharded Table Implementation === */
+
+stash_shmap stash_shmap_create(size_t shard_count, size_t initialCapacity, size_t value_size)
+{
+    stash_shmap map = { 0 };
+
+    shard_count = (size_t)u_stash_ceil_po2_u64((int64_t)shard_count);
+
+    // Every shard starts on its own cache line
+    size_t stride = (sizeof(stash_shmap_shard) + STASH_CACHE_LINE - 1) & ~(size_t)(STASH_CACHE_LINE - 1);
+
+    void* memory = STASH_MALLOC(shard_count * stride + STASH_CACHE_LINE - 1);
+    if (memory == NULL) {
+        return map;
+    }
+
+    map.memory = memory;
+    map.shards = (char*)(((uintptr_t)memory + STASH_CACHE_LINE - 1) & ~(uintptr_t)(STASH_CACHE_LINE - 1));
+    map.shard_stride = stride;
+    map.shard_count = shard_count;
+
+    size_t capacity = (initialCapacity + shard_count - 1) / shard_count;
+
+    for (size_t i = 0; i < shard_count; i++) {
+        stash_shmap_shard* shard = u_stash_shmap_shard_at(&map, i);
+        shard->table = stash_umap_create(capacity, value_size);
+        shard->lock = 0;
+
+        if (!stash_umap_is_valid(&shard->table)) {
+            map.shard_count = i;
+            stash_shmap_destroy(&map);
+            return (stash_shmap) { 0 };
+        }
+    }
+
+    return map;
+}
+
+void stash_shmap_destroy(stash_shmap* map)
+{
+    if (!map || map->memory == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < map->shard_count; i++) {
+        stash_umap_destroy(&u_stash_shmap_shard_at(map, i)->table);
+    }
+
+    STASH_FREE(map->memory);
+
+    map->memory = NULL;
+    map->shards = NULL;
+    map->shard_stride = 0;
+    map->shard_count = 0;
+}
+
+bool stash_shmap_is_valid(const stash_shmap* map)
+{
+    return map && map->memory != NULL && map->shard_count > 0;
+}
+
+int stash_shmap_insert(stash_shmap* map, uint32_t key, const void* value)
+{
+    if (!stash_shmap_is_valid(map) || !value) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    stash_shmap_shard* shard = u_stash_shmap_shard_of(map, key);
+
+    u_stash_spin_lock(&shard->lock);
+    int ret = stash_umap_insert(&shard->table, key, value);
+    u_stash_spin_unlock(&shard->lock);
+
+    return ret;
+}
+
+int stash_shmap_update(stash_shmap* map, uint32_t key, stash_update_fn update, void* user)
+{
+    if (!stash_shmap_is_valid(map) || !update) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    stash_shmap_shard* shard = u_stash_shmap_shard_of(map, key);
+
+    u_stash_spin_lock(&shard->lock);
+
+    // The value is only reachable while the shard is locked
+    bool inserted;
+    void* value = stash_umap_emplace(&shard->table, key, &inserted);
+    if (value != NULL) {
+        update(value, inserted, user);
+    }
+
+    u_stash_spin_unlock(&shard->lock);
+
+    if (value == NULL) {
+        return STASH_ERROR_OUT_OF_MEMORY;
+    }
+
+    return inserted ? STASH_SUCCESS : STASH_KEY_EXISTS;
+}
+
+int stash_shmap_remove(stash_shmap* map, uint32_t key, void* element)
+{
+    if (!stash_shmap_is_valid(map)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    stash_shmap_shard* shard = u_stash_shmap_shard_of(map, key);
+
+    u_stash_spin_lock(&shard->lock);
+    int ret = stash_umap_remove(&shard->table, key, element);
+    u_stash_spin_unlock(&shard->lock);
+
+    return ret;
+}
+
+int stash_shmap_get(stash_shmap* map, uint32_t key, void* element)
+{
+    if (!stash_shmap_is_valid(map)) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    stash_shmap_shard* shard = u_stash_shmap_shard_of(map, key);
+
+    u_stash_spin_lock(&shard->lock);
+    int ret = stash_umap_get(&shard->table, key, element);
+    u_stash_spin_unlock(&shard->lock);
+
+    return ret;
+}
+
+bool stash_shmap_contains(stash_shmap* map, uint32_t key)
+{
+    if (!stash_shmap_is_valid(map)) {
+        return false;
+    }
+
+    stash_shmap_shard* shard = u_stash_shmap_shard_of(map, key);
+
+    u_stash_spin_lock(&shard->lock);
+    bool ret = stash_umap_contains(&shard->table, key);
+    u_stash_spin_unlock(&shard->lock);
+
+    return ret;
+}
+
+size_t stash_shmap_count(stash_shmap* map)
+{
+    if (!stash_shmap_is_valid(map)) {
+        return 0;
+    }
+
+    size_t count = 0;
+
+    for (size_t i = 0; i < map->shard_count; i++) {
+        stash_shmap_shard* shard = u_stash_shmap_shard_at(map, i);
+        u_stash_spin_lock(&shard->lock);
+        count += shard->table.count;
+        u_stash_spin_unlock(&shard->lock);
+    }
+
+    return count;
+}
+
+size_t stash_shmap_shard_count(const stash_shmap* map)
+{
+    return stash_shmap_is_valid(map) ? map->shard_count : 0;
+}
+
+void stash_shmap_for_each(stash_shmap* map, size_t shard_index, stash_visit_fn visit, void* user)
+{
+    if (!stash_shmap_is_valid(map) || !visit || shard_index >= map->shard_count) {
+        return;
+    }
+
+    // Each shard is locked on its own, so different threads can walk different shards at once
+    stash_shmap_shard* shard = u_stash_shmap_shard_at(map, shard_index);
+    stash_umap* table = &shard->table;
+
+    u_stash_spin_lock(&shard->lock);
+
+    if (u_stash_umap_finish_migration(table) == STASH_SUCCESS) {
+        for (size_t i = 0; i < table->buckets.count; i++) {
+            if (!u_stash_umap_is_full(table, i)) continue;
+
+            uint32_t key;
+            memcpy(&key, u_stash_umap_key_at(table, i), sizeof(key));
+            visit(key, u_stash_umap_value_at(table, i), user);
+        }
+    }
+
+    u_stash_spin_unlock(&shard->lock);
+}
+
+#endif // __GNUC__ || __clang__
+
+#if defined(__GNUC__) || defined(__clang__)
+
+/* === Private Lock-Free Table Implementation === */
+
+// Values are stored plus one so that zero means "no value yet", the top bit
+// marks a value being copied to the next table (TOMBPRIME once it is done)
+#define U_STASH_LFMAP_EMPTY_KEY UINT32_MAX
+#define U_STASH_LFMAP_PRIME (1ULL << 63)
+#define U_STASH_LFMAP_TOMBPRIME U_STASH_LFMAP_PRIME
+#define U_STASH_LFMAP_COPY_CHUNK 64
+
+enum {
+    U_STASH_LFMAP_OP_INSERT,
+    U_STASH_LFMAP_OP_STORE,
+    U_STASH_LFMAP_OP_ADD
+};
+
+static stash_lfmap_table* u_stash_lfmap_table_create(size_t bucket_count)
+{
+    stash_lfmap_table* table = (stash_lfmap_table*)STASH_MALLOC(sizeof(stash_lfmap_table));
+    if (table == NULL) {
+        return NULL;
+    }
+
+    table->mask = bucket_count - 1;
+    table->keys = stash_arr_create(bucket_count, sizeof(uint32_t));
+    table->values = stash_arr_create(bucket_count, sizeof(uint64_t));
+    table->used = 0;
+    table->copy_pos = 0;
+    table->copied = 0;
+    table->next = NULL;
+    table->retired = NULL;
+
+    if (!stash_arr_is_valid(&table->keys) || !stash_arr_is_valid(&table->values)) {
+        stash_arr_destroy(&table->keys);
+        stash_arr_destroy(&table->values);
+        STASH_FREE(table);
+        return NULL;
+    }
+
+    table->keys.count = bucket_count;
+    table->values.count = bucket_count;
+    memset(table->keys.data, 0xFF, bucket_count * sizeof(uint32_t));
+    memset(table->values.data, 0, bucket_count * sizeof(uint64_t));
+
+    return table;
+}
+
+static void u_stash_lfmap_table_destroy(stash_lfmap_table* table)
+{
+    stash_arr_destroy(&table->keys);
+    stash_arr_destroy(&table->values);
+    STASH_FREE(table);
+}
+
+static int64_t u_stash_lfmap_find(const stash_lfmap_table* table, uint32_t key, bool* full)
+{
+    // Returns the slot of the key or -1, 'full' tells if the key may still be in the next table
+
+    const uint32_t* keys = (const uint32_t*)table->keys.data;
+    size_t index = (size_t)stash_hash_mix(&key, sizeof(key), 0) & table->mask;
+
+    for (size_t i = 0; i <= table->mask; i++, index = (index + 1) & table->mask) {
+        uint32_t k = __atomic_load_n(&keys[index], __ATOMIC_ACQUIRE);
+        if (k == key) return (int64_t)index;
+        if (k == U_STASH_LFMAP_EMPTY_KEY) {
+            *full = false;
+            return -1;
+        }
+    }
+
+    *full = true;
+    return -1;
+}
+
+static int64_t u_stash_lfmap_claim(stash_lfmap_table* table, uint32_t key, bool* claimed)
+{
+    // Finds the slot of the key or claims a free one with a CAS, -1 if the table is full
+
+    uint32_t* keys = (uint32_t*)table->keys.data;
+    size_t index = (size_t)stash_hash_mix(&key, sizeof(key), 0) & table->mask;
+
+    *claimed = false;
+
+    for (size_t i = 0; i <= table->mask; i++, index = (index + 1) & table->mask) {
+        uint32_t k = __atomic_load_n(&keys[index], __ATOMIC_ACQUIRE);
+
+        if (k == U_STASH_LFMAP_EMPTY_KEY) {
+            if (__atomic_compare_exchange_n(&keys[index], &k, key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_fetch_add(&table->used, 1, __ATOMIC_RELAXED);
+                *claimed = true;
+                return (int64_t)index;
+            }
+            // 'k' now holds the key that won the slot
+        }
+
+        if (k == key) {
+            return (int64_t)index;
+        }
+    }
+
+    return -1;
+}
+
+static stash_lfmap_table* u_stash_lfmap_resize(stash_lfmap_table* table)
+{
+    // Installs the next table if nobody did it yet, returns it (NULL when out of memory)
+
+    stash_lfmap_table* next = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+    if (next != NULL) {
+        return next;
+    }
+
+    stash_lfmap_table* fresh = u_stash_lfmap_table_create((table->mask + 1) * 2);
+    if (fresh == NULL) {
+        return NULL;
+    }
+
+    if (!__atomic_compare_exchange_n(&table->next, &next, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        u_stash_lfmap_table_destroy(fresh); //< Another thread installed its own
+        return next;
+    }
+
+    return fresh;
+}
+
+static void u_stash_lfmap_promote(stash_lfmap* map)
+{
+    // Drops fully copied tables from the front of the chain, oldest first
+
+    for (;;) {
+        stash_lfmap_table* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+        stash_lfmap_table* next = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+
+        if (next == NULL || __atomic_load_n(&table->copied, __ATOMIC_ACQUIRE) <= table->mask) {
+            return;
+        }
+
+        if (__atomic_compare_exchange_n(&map->table, &table, next, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // Other threads may still be reading it, it is freed by stash_lfmap_reclaim()
+            table->retired = __atomic_load_n(&map->retired, __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&map->retired, &table->retired, table, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+        }
+    }
+}
+
+static void u_stash_lfmap_copy_into(stash_lfmap_table* table, uint32_t key, uint64_t stored)
+{
+    // Gives the key its copied value unless it already has one
+
+    for (;;) {
+        bool claimed;
+        int64_t index = u_stash_lfmap_claim(table, key, &claimed);
+
+        if (index >= 0) {
+            uint64_t* slot = &((uint64_t*)table->values.data)[index];
+            uint64_t expected = 0;
+
+            if (__atomic_compare_exchange_n(slot, &expected, stored, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                return;
+            }
+            if (expected != U_STASH_LFMAP_TOMBPRIME) {
+                return; //< A newer value (or a copy of it) is already there
+            }
+        }
+
+        // The slot was sealed empty by a resize of this table, or the table is full
+        stash_lfmap_table* next = u_stash_lfmap_resize(table);
+        if (next == NULL) return;
+        table = next;
+    }
+}
+
+static void u_stash_lfmap_copy_slot(stash_lfmap* map, stash_lfmap_table* table, size_t index)
+{
+    uint64_t* slot = &((uint64_t*)table->values.data)[index];
+    uint64_t value = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+    // Freeze the value, or seal the slot directly if it has none
+    for (;;) {
+        if (value == U_STASH_LFMAP_TOMBPRIME) {
+            return;
+        }
+        if (value & U_STASH_LFMAP_PRIME) {
+            break;
+        }
+
+        uint64_t frozen = (value == 0) ? U_STASH_LFMAP_TOMBPRIME : (value | U_STASH_LFMAP_PRIME);
+        if (__atomic_compare_exchange_n(slot, &value, frozen, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            value = frozen;
+            break;
+        }
+    }
+
+    if (value != U_STASH_LFMAP_TOMBPRIME) {
+        uint32_t key = __atomic_load_n(&((uint32_t*)table->keys.data)[index], __ATOMIC_ACQUIRE);
+        u_stash_lfmap_copy_into(__atomic_load_n(&table->next, __ATOMIC_ACQUIRE), key, value & ~U_STASH_LFMAP_PRIME);
+
+        if (!__atomic_compare_exchange_n(slot, &value, U_STASH_LFMAP_TOMBPRIME, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return; //< Another helper finished this slot
+        }
+    }
+
+    // Only the thread that sealed the slot counts it
+    if (__atomic_add_fetch(&table->copied, 1, __ATOMIC_ACQ_REL) == table->mask + 1) {
+        u_stash_lfmap_promote(map);
+    }
+}
+
+static void u_stash_lfmap_help_copy(stash_lfmap* map, stash_lfmap_table* table)
+{
+    // Every operation that meets a resize copies one chunk of the old table
+
+    size_t start = __atomic_fetch_add(&table->copy_pos, U_STASH_LFMAP_COPY_CHUNK, __ATOMIC_RELAXED);
+    size_t end = start + U_STASH_LFMAP_COPY_CHUNK;
+    if (end > table->mask + 1) end = table->mask + 1;
+
+    for (size_t i = start; i < end; i++) {
+        u_stash_lfmap_copy_slot(map, table, i);
+    }
+}
+
+static int u_stash_lfmap_update(stash_lfmap* map, uint32_t key, uint64_t operand, int op, uint64_t* previous)
+{
+    if (key == U_STASH_LFMAP_EMPTY_KEY) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    stash_lfmap_table* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        bool claimed;
+        int64_t index = u_stash_lfmap_claim(table, key, &claimed);
+
+        if (index < 0) {
+            table = u_stash_lfmap_resize(table);
+            if (table == NULL) return STASH_ERROR_OUT_OF_MEMORY;
+            continue;
+        }
+
+        // Start growing once the table is loaded enough, the copy is shared by all threads
+        if (claimed && __atomic_load_n(&table->used, __ATOMIC_RELAXED) > (size_t)((double)(table->mask + 1) * STASH_UMAP_MAX_LOAD_FACTOR)) {
+            u_stash_lfmap_resize(table);
+        }
+
+        stash_lfmap_table* next = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+        if (next != NULL) {
+            // Values only change in the newest table, move this one there first
+            u_stash_lfmap_help_copy(map, table);
+            u_stash_lfmap_copy_slot(map, table, (size_t)index);
+            table = next;
+            continue;
+        }
+
+        uint64_t* slot = &((uint64_t*)table->values.data)[index];
+        uint64_t value = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            if (value & U_STASH_LFMAP_PRIME) {
+                break; //< A resize started meanwhile
+            }
+
+            if (value != 0 && op == U_STASH_LFMAP_OP_INSERT) {
+                if (previous) *previous = value - 1;
+                return STASH_KEY_EXISTS;
+            }
+
+            uint64_t desired = operand + 1;
+            if (op == U_STASH_LFMAP_OP_ADD) {
+                uint64_t base = (value != 0) ? value : 1;
+                if (operand > U_STASH_LFMAP_PRIME - 1 - base) return STASH_ERROR_OUT_OF_BOUNDS;
+                desired = base + operand;
+            }
+
+            if (__atomic_compare_exchange_n(slot, &value, desired, true, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                if (previous) *previous = (value != 0) ? value - 1 : 0;
+                if (value == 0) {
+                    __atomic_fetch_add(&map->count, 1, __ATOMIC_RELAXED);
+                    return STASH_SUCCESS;
+                }
+                return STASH_KEY_EXISTS;
+            }
+        }
+
+        u_stash_lfmap_copy_slot(map, table, (size_t)index);
+        table = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* === Public Lock-Free Table Implementation === */
+
+stash_lfmap stash_lfmap_create(size_t initialCapacity)
+{
+    stash_lfmap map = { 0 };
+
+    size_t bucket_count = (size_t)u_stash_ceil_po2_u64((int64_t)((double)initialCapacity / STASH_UMAP_MAX_LOAD_FACTOR) + 1);
+    if (bucket_count < 16) bucket_count = 16;
+
+    map.table = u_stash_lfmap_table_create(bucket_count);
+
+    return map;
+}
+
+void stash_lfmap_destroy(stash_lfmap* map)
+{
+    if (!stash_lfmap_is_valid(map)) {
+        return;
+    }
+
+    stash_lfmap_reclaim(map);
+
+    stash_lfmap_table* table = map->table;
+    while (table != NULL) {
+        stash_lfmap_table* next = table->next;
+        u_stash_lfmap_table_destroy(table);
+        table = next;
+    }
+
+    map->table = NULL;
+    map->count = 0;
+}
+
+bool stash_lfmap_is_valid(const stash_lfmap* map)
+{
+    return map && __atomic_load_n(&map->table, __ATOMIC_RELAXED) != NULL;
+}
+
+void stash_lfmap_reclaim(stash_lfmap* map)
+{
+    if (!stash_lfmap_is_valid(map)) {
+        return;
+    }
+
+    stash_lfmap_table* table = map->retired;
+    while (table != NULL) {
+        stash_lfmap_table* retired = table->retired;
+        u_stash_lfmap_table_destroy(table);
+        table = retired;
+    }
+
+    map->retired = NULL;
+}
+
+int stash_lfmap_insert(stash_lfmap* map, uint32_t key, uint64_t value)
+{
+    if (!stash_lfmap_is_valid(map) || value > STASH_LFMAP_VALUE_MAX) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    return u_stash_lfmap_update(map, key, value, U_STASH_LFMAP_OP_INSERT, NULL);
+}
+
+int stash_lfmap_store(stash_lfmap* map, uint32_t key, uint64_t value)
+{
+    if (!stash_lfmap_is_valid(map) || value > STASH_LFMAP_VALUE_MAX) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    return u_stash_lfmap_update(map, key, value, U_STASH_LFMAP_OP_STORE, NULL);
+}
+
+int stash_lfmap_fetch_add(stash_lfmap* map, uint32_t key, uint64_t delta, uint64_t* previous)
+{
+    if (!stash_lfmap_is_valid(map)) {
+        return STASH_ERROR_OUT_OF_BOUNDS;
+    }
+
+    return u_stash_lfmap_update(map, key, delta, U_STASH_LFMAP_OP_ADD, previous);
+}
+
+int stash_lfmap_get(stash_lfmap* map, uint32_t key, uint64_t* value)
+{
+    if (!stash_lfmap_is_valid(map) || key == U_STASH_LFMAP_EMPTY_KEY) {
+        return STASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    stash_lfmap_table* table = __atomic_load_n(&map->table, __ATOMIC_ACQUIRE);
+
+    while (table != NULL) {
+        bool full;
+        int64_t index = u_stash_lfmap_find(table, key, &full);
+
+        if (index < 0) {
+            if (!full) return STASH_ERROR_KEY_NOT_FOUND;
+            table = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        uint64_t stored = __atomic_load_n(&((uint64_t*)table->values.data)[index], __ATOMIC_ACQUIRE);
+
+        if (stored == 0) {
+            return STASH_ERROR_KEY_NOT_FOUND;
+        }
+
+        if (stored & U_STASH_LFMAP_PRIME) {
+            // The newest value lives in the next table once this slot is copied
+            u_stash_lfmap_copy_slot(map, table, (size_t)index);
+            table = __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+            continue;
+        }
+
+        if (value) *value = stored - 1;
+        return STASH_SUCCESS;
+    }
+
+    return STASH_ERROR_KEY_NOT_FOUND;
+}
+
+size_t stash_lfmap_count(const stash_lfmap* map)
+{
+    return stash_lfmap_is_valid(map) ? __atomic_load_n(&map->count, __ATOMIC_RELAXED) : 0;
+}
+
+#endif // __GNUC__ || __clang__
+
 /* === Public Registry Implementation === */
 
 stash_reg stash_reg_create(size_t capacity, size_t elem_size)
@@ -0,0 +1,36 @@
+/*
+ * Shared helpers of the stash tests.
+ * Each test is a single file built on its own, from the repository root:
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_<name>.c -o test_<name> && ./test_<name>
+ *
+ * Threaded tests also need -pthread.
+ * A test prints nothing and exits with 0 when every check passes.
+ */
+
+#ifndef STASH_TEST_H
+#define STASH_TEST_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_CHECK(cond)                                                            \
+    do {                                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+static inline uint64_t test_rand(uint64_t* state)
+{
+    // xorshift64, deterministic so that failures can be replayed
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+#endif // STASH_TEST_H
@@ -0,0 +1,127 @@
+/*
+ * stash_cmap: lock-free readers against a writer that sets, removes and grows.
+ * Values are self-checking, so a torn or stale read that passed validation is caught.
+ *
+ *   cc -std=gnu99 -g -fsanitize=address,undefined -pthread -I. tests/test_cmap.c -o test_cmap && ./test_cmap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define READERS 4
+#define STABLE_KEYS 1000        // Inserted first and never removed
+#define KEYS 20000
+#define WRITES 200000
+
+typedef struct {
+    uint32_t key;
+    uint32_t version;
+    uint64_t check;             // Derived from key and version
+    uint64_t pad[2];            // Version and its complement, to widen the copy
+} value;
+
+static stash_cmap map;
+static volatile int done;
+
+static value make_value(uint32_t key, uint32_t version)
+{
+    value v;
+    v.key = key;
+    v.version = version;
+    v.check = ((uint64_t)key * 2654435761u) ^ version;
+    v.pad[0] = version;
+    v.pad[1] = ~(uint64_t)version;
+    return v;
+}
+
+static void* reader(void* arg)
+{
+    uint64_t state = 7919 * (uint64_t)(uintptr_t)arg + 1;
+
+    for (size_t reads = 1; !__atomic_load_n(&done, __ATOMIC_RELAXED); reads++) {
+        // Let the writer progress when there are fewer cores than threads
+        if (reads % 256 == 0) sched_yield();
+
+        uint32_t key = (uint32_t)(test_rand(&state) % KEYS);
+        value v;
+
+        if (stash_cmap_get(&map, key, &v) == STASH_SUCCESS) {
+            value expected = make_value(key, v.version);
+            TEST_CHECK(memcmp(&v, &expected, sizeof(v)) == 0);
+        }
+        if (key < STABLE_KEYS) {
+            TEST_CHECK(stash_cmap_contains(&map, key));
+        }
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    // Start small so that the writer grows the table while readers run
+    map = stash_cmap_create(0, sizeof(value));
+    TEST_CHECK(stash_cmap_is_valid(&map));
+
+    for (uint32_t key = 0; key < STABLE_KEYS; key++) {
+        value v = make_value(key, 0);
+        TEST_CHECK(stash_cmap_insert(&map, key, &v) == STASH_SUCCESS);
+    }
+
+    pthread_t threads[READERS];
+    for (uintptr_t i = 0; i < READERS; i++) {
+        TEST_CHECK(pthread_create(&threads[i], NULL, reader, (void*)i) == 0);
+    }
+
+    // Single writer, checked against a reference of which keys are present
+    static uint8_t present[KEYS];
+    size_t count = STABLE_KEYS;
+    uint64_t state = 42;
+
+    memset(present, 1, STABLE_KEYS);
+
+    for (int i = 0; i < WRITES; i++) {
+        uint64_t r = test_rand(&state);
+        uint32_t key = STABLE_KEYS + (uint32_t)(r % (KEYS - STABLE_KEYS));
+        uint32_t version = (uint32_t)(r >> 32);
+        value v = make_value(key, version);
+
+        switch (r % 3) {
+        case 0:
+            TEST_CHECK(stash_cmap_set(&map, key, &v) == (present[key] ? STASH_KEY_EXISTS : STASH_SUCCESS));
+            count += !present[key];
+            present[key] = 1;
+            break;
+        case 1:
+            TEST_CHECK(stash_cmap_remove(&map, key, NULL) == (present[key] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+            count -= present[key];
+            present[key] = 0;
+            break;
+        default:
+            key = (uint32_t)(r % STABLE_KEYS);
+            v = make_value(key, version);
+            TEST_CHECK(stash_cmap_set(&map, key, &v) == STASH_KEY_EXISTS);
+            break;
+        }
+    }
+
+    __atomic_store_n(&done, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    TEST_CHECK(stash_cmap_count(&map) == count);
+    for (uint32_t key = 0; key < KEYS; key++) {
+        TEST_CHECK(stash_cmap_contains(&map, key) == (present[key] != 0));
+    }
+
+    // No reader is running any more, retired arrays can go
+    stash_cmap_reclaim(&map);
+    stash_cmap_destroy(&map);
+
+    return 0;
+}
@@ -0,0 +1,156 @@
+/*
+ * stash_fmap: freezing tables of every layout and size, then looking up every key and
+ * keys that were never inserted.
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_fmap.c -o test_fmap && ./test_fmap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+typedef struct {
+    uint32_t parts[3];
+} wide_key;
+
+static void check_frozen(uint32_t flags, size_t n, stash_hash_fn hash)
+{
+    // Keys are a stride apart, so identity hashes put them in few groups
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+    if (hash) TEST_CHECK(stash_umap_set_hash(&table, hash, 0) == STASH_SUCCESS);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t value = i * 7ull;
+        TEST_CHECK(stash_umap_insert(&table, i * 64, &value) == STASH_SUCCESS);
+    }
+
+    stash_fmap map;
+    TEST_CHECK(stash_umap_freeze(&table, &map) == STASH_SUCCESS);
+
+    // The frozen map owns its memory
+    stash_umap_destroy(&table);
+
+    TEST_CHECK(stash_fmap_is_valid(&map));
+    TEST_CHECK(stash_fmap_count(&map) == n);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t value = 0;
+        TEST_CHECK(stash_fmap_get(&map, i * 64, &value) == STASH_SUCCESS && value == i * 7ull);
+        TEST_CHECK(stash_fmap_contains(&map, i * 64));
+
+        const uint64_t* found = (const uint64_t*)stash_fmap_find(&map, i * 64);
+        TEST_CHECK(found && *found == i * 7ull);
+    }
+
+    for (uint32_t i = 0; i < n + 100; i++) {
+        uint64_t value;
+        TEST_CHECK(stash_fmap_get(&map, i * 64 + 1, &value) == STASH_ERROR_KEY_NOT_FOUND);
+        TEST_CHECK(!stash_fmap_contains(&map, i * 64 + 1));
+    }
+
+    stash_fmap_destroy(&map);
+}
+
+static void check_keyed(void)
+{
+    // Wide keys and no value, the frozen map works as a set
+    stash_umap table = stash_umap_create_keyed(0, sizeof(wide_key), 0, STASH_UMAP_INLINE);
+
+    for (uint32_t i = 0; i < 5000; i++) {
+        wide_key key = { { i, ~i, i * 3 } };
+        bool inserted = false;
+        TEST_CHECK(stash_umap_emplace_key(&table, &key, &inserted) && inserted);
+    }
+
+    stash_fmap map;
+    TEST_CHECK(stash_umap_freeze(&table, &map) == STASH_SUCCESS);
+    stash_umap_destroy(&table);
+
+    TEST_CHECK(stash_fmap_count(&map) == 5000);
+
+    for (uint32_t i = 0; i < 5000; i++) {
+        wide_key key = { { i, ~i, i * 3 } };
+        wide_key other = { { i, ~i, i * 3 + 1 } };
+        TEST_CHECK(stash_fmap_contains_key(&map, &key));
+        TEST_CHECK(!stash_fmap_contains_key(&map, &other));
+    }
+
+    // Keyed maps have no uint32_t lookups
+    TEST_CHECK(!stash_fmap_contains(&map, 0));
+
+    stash_fmap_destroy(&map);
+}
+
+static void check_symmetric(stash_hash_fn hash)
+{
+    // Swapped and repeated words fold to the same hash, the frozen map must separate them anyway
+    typedef struct { uint64_t words[2]; } pair_key;
+
+    stash_umap table = stash_umap_create_keyed(0, sizeof(pair_key), sizeof(uint32_t), STASH_UMAP_INLINE);
+    TEST_CHECK(stash_umap_set_hash(&table, hash, 0) == STASH_SUCCESS);
+
+    for (uint32_t i = 0; i < 500; i++) {
+        pair_key keys[3] = { { { i, i + 1 } }, { { i + 1, i } }, { { i, i } } };
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t value = i * 3 + k;
+            TEST_CHECK(stash_umap_insert_key(&table, &keys[k], &value) == STASH_SUCCESS);
+        }
+    }
+
+    stash_fmap map;
+    TEST_CHECK(stash_umap_freeze(&table, &map) == STASH_SUCCESS);
+    stash_umap_destroy(&table);
+
+    TEST_CHECK(stash_fmap_count(&map) == 1500);
+
+    for (uint32_t i = 0; i < 500; i++) {
+        pair_key keys[3] = { { { i, i + 1 } }, { { i + 1, i } }, { { i, i } } };
+        for (uint32_t k = 0; k < 3; k++) {
+            uint32_t value = 0;
+            TEST_CHECK(stash_fmap_get_key(&map, &keys[k], &value) == STASH_SUCCESS && value == i * 3 + k);
+        }
+
+        pair_key absent = { { i + 2, i } };
+        TEST_CHECK(!stash_fmap_contains_key(&map, &absent));
+    }
+
+    stash_fmap_destroy(&map);
+}
+
+int main(void)
+{
+    static const uint32_t layouts[] = {
+        STASH_UMAP_INLINE,
+        STASH_UMAP_SPLIT,
+        STASH_UMAP_INCREMENTAL,     // Frozen while a migration is still running
+        STASH_UMAP_ORDERED,
+        STASH_UMAP_SMALL,
+    };
+    static const size_t sizes[] = { 0, 1, 2, 7, 100, 4097, 100000 };
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            check_frozen(layouts[l], sizes[s], NULL);
+        }
+    }
+
+    check_frozen(STASH_UMAP_INLINE, 20000, stash_hash_identity);
+    check_frozen(STASH_UMAP_INLINE, 20000, stash_hash_fibonacci);
+    check_keyed();
+    check_symmetric(stash_hash_identity);
+    check_symmetric(stash_hash_fibonacci);
+    check_symmetric(stash_hash_mix);
+
+    // A destroyed map finds nothing
+    stash_fmap map;
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), STASH_UMAP_INLINE);
+    TEST_CHECK(stash_umap_freeze(&table, &map) == STASH_SUCCESS);
+    stash_fmap_destroy(&map);
+    stash_umap_destroy(&table);
+
+    TEST_CHECK(!stash_fmap_is_valid(&map));
+    TEST_CHECK(stash_fmap_count(&map) == 0);
+    TEST_CHECK(!stash_fmap_contains(&map, 0));
+
+    return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * stash_lfmap: threads insert, store, fetch_add and get at once while the table grows.
+ * Each thread owns a range of keys and keeps a reference of them, every thread races
+ * to insert a shared range, and shared counters must add up to the sum of all deltas.
+ * The map has no remove, so none is tested.
+ *
+ *   cc -std=gnu99 -g -fsanitize=address,undefined -pthread -I. tests/test_lfmap.c -o test_lfmap && ./test_lfmap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define THREADS 4
+#define OWN_KEYS 20000          // Per thread, written only by their owner
+#define SHARED_KEYS 5000        // Every thread tries to insert each of them
+#define COUNTERS 64             // Incremented by every thread
+
+#define OWN_BASE 1
+#define SHARED_BASE (OWN_BASE + THREADS * OWN_KEYS)
+#define COUNTER_BASE (SHARED_BASE + SHARED_KEYS)
+
+static stash_lfmap map;
+static size_t shared_wins;
+static uint64_t counter_totals[THREADS][COUNTERS];
+
+static void* worker(void* arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    uint32_t base = OWN_BASE + (uint32_t)id * OWN_KEYS;
+    uint64_t state = 7919 * (uint64_t)id + 1;
+    static uint64_t expected[THREADS][OWN_KEYS];
+    uint64_t* own = expected[id];
+
+    for (uint32_t i = 0; i < OWN_KEYS; i++) {
+        // Let the others progress when there are fewer cores than threads
+        if (i % 16 == 0) sched_yield();
+
+        uint32_t key = base + i;
+        uint64_t previous;
+
+        TEST_CHECK(stash_lfmap_insert(&map, key, key * 3ull) == STASH_SUCCESS);
+        own[i] = key * 3ull;
+
+        // Overwrite an earlier key of this thread
+        uint32_t j = (uint32_t)(test_rand(&state) % (i + 1));
+        TEST_CHECK(stash_lfmap_store(&map, base + j, own[j] + 1) == STASH_KEY_EXISTS);
+        own[j]++;
+
+        // Race the other threads on a shared key, exactly one insert wins
+        uint32_t shared = SHARED_BASE + (uint32_t)(test_rand(&state) % SHARED_KEYS);
+        int result = stash_lfmap_insert(&map, shared, shared);
+        TEST_CHECK(result == STASH_SUCCESS || result == STASH_KEY_EXISTS);
+        if (result == STASH_SUCCESS) __atomic_fetch_add(&shared_wins, 1, __ATOMIC_RELAXED);
+
+        uint32_t counter = (uint32_t)(test_rand(&state) % COUNTERS);
+        uint64_t delta = 1 + test_rand(&state) % 7;
+        result = stash_lfmap_fetch_add(&map, COUNTER_BASE + counter, delta, &previous);
+        TEST_CHECK(result == STASH_SUCCESS || result == STASH_KEY_EXISTS);
+        counter_totals[id][counter] += delta;
+
+        // Own keys read back exactly, keys of other threads hold their insert plus a few stores
+        uint32_t k = (uint32_t)(test_rand(&state) % (i + 1));
+        uint64_t value;
+        TEST_CHECK(stash_lfmap_get(&map, base + k, &value) == STASH_SUCCESS && value == own[k]);
+
+        uint32_t other = OWN_BASE + (uint32_t)(test_rand(&state) % (THREADS * OWN_KEYS));
+        if (stash_lfmap_get(&map, other, &value) == STASH_SUCCESS) {
+            TEST_CHECK(value >= other * 3ull && value - other * 3ull <= OWN_KEYS);
+        }
+        if (stash_lfmap_get(&map, shared, &value) == STASH_SUCCESS) {
+            TEST_CHECK(value == shared);
+        }
+    }
+
+    // Every key of this thread survived the resizes of the others
+    for (uint32_t i = 0; i < OWN_KEYS; i++) {
+        uint64_t value;
+        TEST_CHECK(stash_lfmap_get(&map, base + i, &value) == STASH_SUCCESS && value == own[i]);
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    // Start small so that every thread runs into resizes
+    map = stash_lfmap_create(0);
+    TEST_CHECK(stash_lfmap_is_valid(&map));
+
+    pthread_t threads[THREADS];
+    for (uintptr_t i = 0; i < THREADS; i++) {
+        TEST_CHECK(pthread_create(&threads[i], NULL, worker, (void*)i) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    size_t shared_present = 0;
+    for (uint32_t key = SHARED_BASE; key < SHARED_BASE + SHARED_KEYS; key++) {
+        uint64_t value;
+        if (stash_lfmap_get(&map, key, &value) == STASH_SUCCESS) {
+            TEST_CHECK(value == key);
+            shared_present++;
+        }
+    }
+    TEST_CHECK(shared_present == shared_wins);
+
+    size_t counters_present = 0;
+    for (uint32_t c = 0; c < COUNTERS; c++) {
+        uint64_t total = 0, value;
+        for (int t = 0; t < THREADS; t++) total += counter_totals[t][c];
+        if (total == 0) continue;
+
+        TEST_CHECK(stash_lfmap_get(&map, COUNTER_BASE + c, &value) == STASH_SUCCESS && value == total);
+        counters_present++;
+    }
+
+    TEST_CHECK(stash_lfmap_count(&map) == (size_t)THREADS * OWN_KEYS + shared_present + counters_present);
+
+    uint64_t value;
+    TEST_CHECK(stash_lfmap_get(&map, COUNTER_BASE + COUNTERS, &value) == STASH_ERROR_KEY_NOT_FOUND);
+    TEST_CHECK(stash_lfmap_insert(&map, UINT32_MAX, 1) == STASH_ERROR_OUT_OF_BOUNDS);
+    TEST_CHECK(stash_lfmap_store(&map, 1, STASH_LFMAP_VALUE_MAX + 1) == STASH_ERROR_OUT_OF_BOUNDS);
+
+    // All threads are done, retired tables can go
+    stash_lfmap_reclaim(&map);
+    stash_lfmap_destroy(&map);
+
+    return 0;
+}
@@ -0,0 +1,200 @@
+/*
+ * stash_shmap: threads insert, remove, update and read at once while a sweeper walks the
+ * shards, then the shards are walked in parallel and every entry must be seen exactly
+ * once, in the shard its key belongs to. Each thread owns a range of keys and keeps a
+ * reference of them, shared counters must add up to the sum of all deltas.
+ *
+ *   cc -std=gnu99 -g -fsanitize=address,undefined -pthread -I. tests/test_shmap.c -o test_shmap && ./test_shmap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#define THREADS 4
+#define SHARDS 8
+#define OWN_KEYS 20000          // Per thread, written only by their owner
+#define COUNTERS 64             // Updated by every thread
+
+#define OWN_BASE 1
+#define COUNTER_BASE (OWN_BASE + THREADS * OWN_KEYS)
+#define KEY_END (COUNTER_BASE + COUNTERS)
+
+static stash_shmap map;
+static volatile int writers_done;
+static uint8_t present[THREADS][OWN_KEYS];
+static uint64_t counter_totals[THREADS][COUNTERS];
+
+static void add(void* value, bool inserted, void* user)
+{
+    uint64_t v = inserted ? 0 : *(uint64_t*)value;
+    v += *(const uint64_t*)user;
+    memcpy(value, &v, sizeof(v));
+}
+
+static void* writer(void* arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    uint32_t base = OWN_BASE + (uint32_t)id * OWN_KEYS;
+    uint64_t state = 7919 * (uint64_t)id + 1;
+    uint8_t* own = present[id];
+
+    for (uint32_t i = 0; i < OWN_KEYS; i++) {
+        // Let the others progress when there are fewer cores than threads
+        if (i % 16 == 0) sched_yield();
+
+        uint32_t key = base + i;
+        uint64_t value = key * 3ull;
+        TEST_CHECK(stash_shmap_insert(&map, key, &value) == STASH_SUCCESS);
+        TEST_CHECK(stash_shmap_insert(&map, key, &value) == STASH_KEY_EXISTS);
+        own[i] = 1;
+
+        // Remove an earlier key of this thread now and then
+        uint32_t j = (uint32_t)(test_rand(&state) % (i + 1));
+        if (test_rand(&state) % 4 == 0) {
+            uint64_t removed = 0;
+            int ret = stash_shmap_remove(&map, base + j, &removed);
+            TEST_CHECK(ret == (own[j] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+            if (own[j]) TEST_CHECK(removed == (base + j) * 3ull);
+            own[j] = 0;
+        }
+
+        uint32_t counter = (uint32_t)(test_rand(&state) % COUNTERS);
+        uint64_t delta = 1 + test_rand(&state) % 7;
+        int ret = stash_shmap_update(&map, COUNTER_BASE + counter, add, &delta);
+        TEST_CHECK(ret == STASH_SUCCESS || ret == STASH_KEY_EXISTS);
+        counter_totals[id][counter] += delta;
+
+        // Own keys read back exactly, keys of other threads are either there with their value or gone
+        uint32_t k = (uint32_t)(test_rand(&state) % (i + 1));
+        TEST_CHECK(stash_shmap_get(&map, base + k, &value) == (own[k] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+        if (own[k]) TEST_CHECK(value == (base + k) * 3ull);
+        TEST_CHECK(stash_shmap_contains(&map, base + k) == (own[k] != 0));
+
+        uint32_t other = OWN_BASE + (uint32_t)(test_rand(&state) % (THREADS * OWN_KEYS));
+        if (stash_shmap_get(&map, other, &value) == STASH_SUCCESS) {
+            TEST_CHECK(value == other * 3ull);
+        }
+    }
+
+    return NULL;
+}
+
+static void visit_live(uint32_t key, void* value, void* user)
+{
+    uint64_t v;
+    memcpy(&v, value, sizeof(v));
+    (void)user;
+
+    TEST_CHECK(key >= OWN_BASE && key < KEY_END);
+    if (key < COUNTER_BASE) TEST_CHECK(v == key * 3ull);
+}
+
+static void* sweeper(void* arg)
+{
+    // Walks the shards while the writers are still at work
+    (void)arg;
+
+    while (!__atomic_load_n(&writers_done, __ATOMIC_ACQUIRE)) {
+        for (size_t s = 0; s < stash_shmap_shard_count(&map); s++) {
+            stash_shmap_for_each(&map, s, visit_live, NULL);
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    size_t shard;
+    uint8_t* seen;
+} sweep;
+
+static void visit_final(uint32_t key, void* value, void* user)
+{
+    sweep* state = (sweep*)user;
+    uint64_t v;
+    memcpy(&v, value, sizeof(v));
+
+    // Every entry lives in the shard its key maps to, and is visited once
+    TEST_CHECK(key >= OWN_BASE && key < KEY_END);
+    TEST_CHECK(u_stash_shmap_shard_of(&map, key) == u_stash_shmap_shard_at(&map, state->shard));
+    TEST_CHECK(__atomic_fetch_add(&state->seen[key], 1, __ATOMIC_RELAXED) == 0);
+
+    if (key < COUNTER_BASE) {
+        TEST_CHECK(v == key * 3ull);
+    }
+    else {
+        uint64_t total = 0;
+        for (int t = 0; t < THREADS; t++) total += counter_totals[t][key - COUNTER_BASE];
+        TEST_CHECK(v == total);
+    }
+}
+
+static uint8_t seen[KEY_END];
+
+static void* final_sweeper(void* arg)
+{
+    // Thread 'id' walks shards id, id + THREADS, ...
+    uintptr_t id = (uintptr_t)arg;
+
+    for (size_t s = id; s < SHARDS; s += THREADS) {
+        sweep state = { s, seen };
+        stash_shmap_for_each(&map, s, visit_final, &state);
+    }
+
+    return NULL;
+}
+
+int main(void)
+{
+    // Start small so that every shard grows while it is shared
+    map = stash_shmap_create(SHARDS, 0, sizeof(uint64_t));
+    TEST_CHECK(stash_shmap_is_valid(&map));
+    TEST_CHECK(stash_shmap_shard_count(&map) == SHARDS);
+
+    pthread_t threads[THREADS], sweep_thread;
+    TEST_CHECK(pthread_create(&sweep_thread, NULL, sweeper, NULL) == 0);
+    for (uintptr_t i = 0; i < THREADS; i++) {
+        TEST_CHECK(pthread_create(&threads[i], NULL, writer, (void*)i) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    __atomic_store_n(&writers_done, 1, __ATOMIC_RELEASE);
+    pthread_join(sweep_thread, NULL);
+
+    for (uintptr_t i = 0; i < THREADS; i++) {
+        TEST_CHECK(pthread_create(&threads[i], NULL, final_sweeper, (void*)i) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    // The sweep saw exactly the keys the references hold
+    size_t expected = 0;
+    for (uint32_t t = 0; t < THREADS; t++) {
+        for (uint32_t i = 0; i < OWN_KEYS; i++) {
+            TEST_CHECK(seen[OWN_BASE + t * OWN_KEYS + i] == present[t][i]);
+            expected += present[t][i];
+        }
+    }
+    for (uint32_t c = 0; c < COUNTERS; c++) {
+        uint64_t total = 0;
+        for (int t = 0; t < THREADS; t++) total += counter_totals[t][c];
+        TEST_CHECK(seen[COUNTER_BASE + c] == (total > 0));
+        expected += total > 0;
+    }
+    TEST_CHECK(stash_shmap_count(&map) == expected);
+
+    // Out of range shards and a destroyed map are ignored
+    stash_shmap_for_each(&map, SHARDS, visit_final, NULL);
+    stash_shmap_destroy(&map);
+    TEST_CHECK(!stash_shmap_is_valid(&map));
+    TEST_CHECK(stash_shmap_count(&map) == 0 && !stash_shmap_contains(&map, OWN_BASE));
+
+    return 0;
+}
@@ -0,0 +1,165 @@
+/*
+ * stash_smap: random inserts and removals against a reference, with keys of every length
+ * around the inline limit, binary keys, the empty key, and the key arena compacted as
+ * long keys are removed.
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_smap.c -o test_smap && ./test_smap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#include <stdio.h>
+
+#define KEYS 3000
+#define OPS 200000
+#define MAX_LEN 40
+
+typedef struct {
+    char bytes[MAX_LEN + 8];
+    size_t len;
+    uint64_t value;
+    uint8_t present;
+} entry;
+
+static entry reference[KEYS];
+static size_t count;
+
+static void make_key(uint32_t i, entry* e)
+{
+    // Key 0 is empty, the others are their index padded to every length up to MAX_LEN,
+    // half of them with zero bytes
+    if (i == 0) {
+        e->len = 0;
+        return;
+    }
+
+    int digits = snprintf(e->bytes, sizeof(e->bytes), "%u", (unsigned)i);
+    size_t len = i % (MAX_LEN + 1);
+    if (len < (size_t)digits) len = (size_t)digits;
+
+    memset(e->bytes + digits, (i & 1) ? 'x' : '\0', len - (size_t)digits);
+    e->len = len;
+}
+
+static size_t live_arena_bytes(void)
+{
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < KEYS; i++) {
+        if (reference[i].present && reference[i].len > STASH_SMAP_INLINE_KEY) bytes += reference[i].len + 1;
+    }
+    return bytes;
+}
+
+static void check_all(stash_smap* map)
+{
+    TEST_CHECK(stash_smap_count(map) == count);
+
+    for (uint32_t i = 0; i < KEYS; i++) {
+        const entry* e = &reference[i];
+        uint64_t value = 0;
+        TEST_CHECK(stash_smap_get(map, e->bytes, e->len, &value) == (e->present ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+        if (e->present) TEST_CHECK(value == e->value);
+    }
+
+    // Iteration hands back every key with its own bytes and length
+    size_t seen = 0;
+    for (stash_it it = stash_smap_begin(map); it.curr != NULL; stash_smap_next(map, &it)) {
+        size_t len;
+        const char* key = stash_smap_key(map, &it, &len);
+        uint64_t value;
+        memcpy(&value, it.curr, sizeof(value));
+
+        uint32_t i = (uint32_t)(value >> 32);
+        TEST_CHECK(i < KEYS && reference[i].present && reference[i].value == value);
+        TEST_CHECK(len == reference[i].len && memcmp(key, reference[i].bytes, len) == 0);
+        seen++;
+    }
+    TEST_CHECK(seen == count);
+
+    // Only removed long keys are garbage
+    TEST_CHECK(map->arena.count - map->arena_garbage == live_arena_bytes());
+}
+
+int main(void)
+{
+    for (uint32_t i = 0; i < KEYS; i++) {
+        make_key(i, &reference[i]);
+    }
+
+    stash_smap map = stash_smap_create(0, sizeof(uint64_t));
+    TEST_CHECK(stash_smap_is_valid(&map));
+
+    uint64_t state = 42;
+    size_t compactions = 0;
+
+    for (uint64_t op = 0; op < OPS; op++) {
+        uint64_t r = test_rand(&state);
+        uint32_t i = (uint32_t)(r % KEYS);
+        entry* e = &reference[i];
+        size_t garbage = map.arena_garbage;
+
+        if ((r >> 32) % 5 < 2) {
+            uint64_t removed = 0;
+            TEST_CHECK(stash_smap_remove(&map, e->bytes, e->len, &removed) == (e->present ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+            if (e->present) {
+                TEST_CHECK(removed == e->value);
+                e->present = 0;
+                count--;
+            }
+        }
+        else {
+            uint64_t value = ((uint64_t)i << 32) | (uint32_t)op;
+            TEST_CHECK(stash_smap_insert(&map, e->bytes, e->len, &value) == (e->present ? STASH_KEY_EXISTS : STASH_SUCCESS));
+            if (!e->present) {
+                e->value = value;
+                e->present = 1;
+                count++;
+            }
+        }
+
+        // Compaction leaves exactly the live long keys in the arena
+        if (map.arena_garbage == 0 && garbage >= 4096) {
+            TEST_CHECK(map.arena.count == live_arena_bytes());
+            compactions++;
+        }
+
+        TEST_CHECK(stash_smap_contains(&map, e->bytes, e->len) == (e->present != 0));
+        if (op % 10000 == 0) check_all(&map);
+    }
+
+    check_all(&map);
+    TEST_CHECK(compactions > 0);
+
+    // The empty key may be passed as NULL or as any pointer
+    stash_smap_clear(&map);
+    uint64_t value = 7;
+    TEST_CHECK(stash_smap_insert(&map, NULL, 0, &value) == STASH_SUCCESS);
+    TEST_CHECK(stash_smap_insert(&map, "", 0, &value) == STASH_KEY_EXISTS);
+    TEST_CHECK(stash_smap_contains(&map, "abc", 0) && stash_smap_find(&map, NULL, 0) != NULL);
+    TEST_CHECK(stash_smap_get(&map, NULL, 0, &value) == STASH_SUCCESS && value == 7);
+    TEST_CHECK(stash_smap_remove(&map, NULL, 0, NULL) == STASH_SUCCESS);
+    TEST_CHECK(!stash_smap_contains(&map, NULL, 0));
+
+    bool inserted = false;
+    TEST_CHECK(stash_smap_emplace(&map, NULL, 0, &inserted) != NULL && inserted);
+    TEST_CHECK(stash_smap_insert(&map, NULL, 1, &value) == STASH_ERROR_OUT_OF_MEMORY);
+    TEST_CHECK(!stash_smap_contains(&map, NULL, 1));
+
+    // Keys on either side of the inline limit, and the cleared arena reused from the start
+    char key[STASH_SMAP_INLINE_KEY + 2];
+    memset(key, 'k', sizeof(key));
+    TEST_CHECK(stash_smap_insert(&map, key, STASH_SMAP_INLINE_KEY, &value) == STASH_SUCCESS);
+    TEST_CHECK(map.arena.count == 0);
+    TEST_CHECK(stash_smap_insert(&map, key, STASH_SMAP_INLINE_KEY + 1, &value) == STASH_SUCCESS);
+    TEST_CHECK(map.arena.count == STASH_SMAP_INLINE_KEY + 2);
+    TEST_CHECK(stash_smap_count(&map) == 3);
+    TEST_CHECK(!stash_smap_contains(&map, key, STASH_SMAP_INLINE_KEY + 2));
+
+    stash_smap_destroy(&map);
+    TEST_CHECK(!stash_smap_is_valid(&map));
+    TEST_CHECK(!stash_smap_contains(&map, NULL, 0));
+
+    return 0;
+}
@@ -0,0 +1,275 @@
+/*
+ * stash_umap_save / stash_umap_map: tables of every layout saved and mapped back, every key
+ * found with its value and absent keys rejected, then damaged copies of a snapshot that
+ * must all be refused.
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_snapshot.c -o test_snapshot && ./test_snapshot
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#define PATH "test_snapshot.tmp"
+#define DAMAGED_PATH "test_snapshot_damaged.tmp"
+
+static const uint32_t layouts[] = {
+    STASH_UMAP_INLINE,
+    STASH_UMAP_SPLIT,
+    STASH_UMAP_INCREMENTAL,
+    STASH_UMAP_ORDERED,
+    STASH_UMAP_SMALL,
+};
+
+#define LAYOUT_COUNT (sizeof(layouts) / sizeof(layouts[0]))
+
+static bool is_present(uint32_t i)
+{
+    // Every third key is removed before saving, ordered tables keep them as dead entries
+    return i % 3 != 1;
+}
+
+static void check_round_trip(uint32_t flags, uint32_t n)
+{
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint64_t value = i * 3ull;
+        TEST_CHECK(stash_umap_insert(&table, i * 7, &value) == STASH_SUCCESS);
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (!is_present(i)) TEST_CHECK(stash_umap_remove(&table, i * 7, NULL) == STASH_SUCCESS);
+    }
+
+    TEST_CHECK(stash_umap_save(&table, PATH) == STASH_SUCCESS);
+    size_t count = stash_umap_count(&table);
+    stash_umap_destroy(&table);
+
+    stash_umap mapped;
+    TEST_CHECK(stash_umap_map(&mapped, PATH, NULL) == STASH_SUCCESS);
+    TEST_CHECK(stash_umap_count(&mapped) == count);
+
+    for (uint32_t i = 0; i < n + 100; i++) {
+        uint64_t value = 0;
+        bool present = i < n && is_present(i);
+
+        TEST_CHECK(stash_umap_get(&mapped, i * 7, &value) == (present ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+        if (present) TEST_CHECK(value == i * 3ull);
+        TEST_CHECK(!stash_umap_contains(&mapped, i * 7 + 1));
+    }
+
+    // Ordered tables still iterate in insertion order
+    size_t seen = 0;
+    uint64_t last = 0;
+    for (stash_it it = stash_umap_begin(&mapped); it.curr != NULL; stash_umap_next(&mapped, &it)) {
+        uint64_t value;
+        memcpy(&value, it.curr, sizeof(value));
+        TEST_CHECK(value % 3 == 0 && is_present((uint32_t)(value / 3)));
+        if ((flags & STASH_UMAP_ORDERED) && seen > 0) TEST_CHECK(value > last);
+        last = value;
+        seen++;
+    }
+    TEST_CHECK(seen == count);
+
+    // Read-only: the mapping cannot take new keys
+    uint64_t value = 0;
+    TEST_CHECK(stash_umap_insert(&mapped, n * 7 + 1, &value) < 0);
+
+    stash_umap_destroy(&mapped);
+}
+
+static size_t load(const char* path, char** bytes)
+{
+    FILE* file = fopen(path, "rb");
+    TEST_CHECK(file != NULL);
+
+    fseek(file, 0, SEEK_END);
+    size_t size = (size_t)ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    *bytes = (char*)malloc(size);
+    TEST_CHECK(*bytes != NULL && fread(*bytes, 1, size, file) == size);
+    fclose(file);
+
+    return size;
+}
+
+static int map_damaged(const char* bytes, size_t size)
+{
+    FILE* file = fopen(DAMAGED_PATH, "wb");
+    TEST_CHECK(file != NULL && fwrite(bytes, 1, size, file) == size);
+    fclose(file);
+
+    stash_umap mapped;
+    int ret = stash_umap_map(&mapped, DAMAGED_PATH, NULL);
+    if (ret == STASH_SUCCESS) stash_umap_destroy(&mapped);
+
+    return ret;
+}
+
+static void check_damaged(uint32_t flags)
+{
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint64_t value = i;
+        TEST_CHECK(stash_umap_insert(&table, i, &value) == STASH_SUCCESS);
+    }
+    for (uint32_t i = 0; i < 1000; i += 3) {
+        TEST_CHECK(stash_umap_remove(&table, i, NULL) == STASH_SUCCESS);
+    }
+    TEST_CHECK(stash_umap_save(&table, PATH) == STASH_SUCCESS);
+    stash_umap_destroy(&table);
+
+    char* bytes;
+    size_t size = load(PATH, &bytes);
+    char* copy = (char*)malloc(size);
+    TEST_CHECK(copy != NULL);
+
+    u_stash_umap_file header;
+    memcpy(&header, bytes, sizeof(header));
+    uint8_t* ctrl = (uint8_t*)copy + header.ctrl_offset;
+    uint8_t* dists = (uint8_t*)copy + header.dists_offset;
+    size_t n = (size_t)header.bucket_count;
+
+    // An untouched copy maps, so each refusal below comes from its own damage
+    TEST_CHECK(map_damaged(bytes, size) == STASH_SUCCESS);
+
+    // Sizes that do not match the arrays
+    TEST_CHECK(map_damaged(bytes, size - 1) == STASH_ERROR_IO);
+    TEST_CHECK(map_damaged(bytes, sizeof(header) - 1) == STASH_ERROR_IO);
+
+    u_stash_umap_file* damaged = (u_stash_umap_file*)copy;
+
+    memcpy(copy, bytes, size);
+    damaged->count++;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    memcpy(copy, bytes, size);
+    damaged->value_offset = UINT64_MAX;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    memcpy(copy, bytes, size);
+    damaged->bucket_count *= 2;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    // Control bytes: neither empty nor a tag, a slot emptied behind the header's back, a bad mirror
+    size_t empty = 0, full = 0, first_of_run = n;
+    for (size_t i = 0; i < n; i++) {
+        uint8_t c = (uint8_t)bytes[header.ctrl_offset + i];
+        if (c == U_STASH_CTRL_EMPTY) empty = i;
+        else full = i;
+        if (c != U_STASH_CTRL_EMPTY && (uint8_t)bytes[header.ctrl_offset + ((i - 1) & (n - 1))] == U_STASH_CTRL_EMPTY) first_of_run = i;
+    }
+    TEST_CHECK(first_of_run < n);
+
+    memcpy(copy, bytes, size);
+    ctrl[empty] = 0xFE;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    memcpy(copy, bytes, size);
+    ctrl[full] = U_STASH_CTRL_EMPTY;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    memcpy(copy, bytes, size);
+    ctrl[n] ^= 1;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    // A run that starts away from its home
+    memcpy(copy, bytes, size);
+    dists[first_of_run] = 1;
+    TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+    if (flags & STASH_UMAP_ORDERED) {
+        size_t index_offset = (size_t)((header.key_size + sizeof(uint32_t) - 1) & ~(uint64_t)(sizeof(uint32_t) - 1));
+        char* index = copy + header.buckets_offset + full * header.bucket_stride + index_offset;
+        const uint8_t* live = (const uint8_t*)bytes + header.live_offset;
+
+        // An entry index past the end, and one of a removed entry
+        uint32_t entry = (uint32_t)header.entry_count;
+        memcpy(copy, bytes, size);
+        memcpy(index, &entry, sizeof(entry));
+        TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+        for (entry = 0; live[entry]; entry++) {
+        }
+        memcpy(copy, bytes, size);
+        memcpy(index, &entry, sizeof(entry));
+        TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+        memcpy(copy, bytes, size);
+        copy[header.live_offset + entry] = 2;
+        TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+
+        memcpy(copy, bytes, size);
+        damaged->tombstones++;
+        TEST_CHECK(map_damaged(copy, size) == STASH_ERROR_IO);
+    }
+
+    free(copy);
+    free(bytes);
+}
+
+static void check_read_only_settings(void)
+{
+    // A mapped table cannot be rebuilt, settings that need a rebuild leave it as it was
+    stash_umap table = stash_umap_create(0, sizeof(uint64_t));
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint64_t value = i * 3ull;
+        TEST_CHECK(stash_umap_insert(&table, i, &value) == STASH_SUCCESS);
+    }
+    TEST_CHECK(stash_umap_save(&table, PATH) == STASH_SUCCESS);
+    stash_umap_destroy(&table);
+
+    stash_umap mapped;
+    TEST_CHECK(stash_umap_map(&mapped, PATH, NULL) == STASH_SUCCESS);
+
+    float load_factor = mapped.max_load_factor;
+    size_t growth_limit = mapped.growth_limit;
+    stash_hash_fn hash = mapped.hash;
+
+    TEST_CHECK(stash_umap_set_max_load_factor(&mapped, 0.1f) == STASH_ERROR_OUT_OF_BOUNDS);
+    TEST_CHECK(mapped.max_load_factor == load_factor && mapped.growth_limit == growth_limit);
+
+    TEST_CHECK(stash_umap_set_hash(&mapped, stash_hash_fibonacci, 1) == STASH_ERROR_OUT_OF_BOUNDS);
+    TEST_CHECK(mapped.hash == hash && mapped.seed == 0);
+
+    for (uint32_t i = 0; i < 1000; i++) {
+        uint64_t value = 0;
+        TEST_CHECK(stash_umap_get(&mapped, i, &value) == STASH_SUCCESS && value == i * 3ull);
+    }
+
+    stash_umap_destroy(&mapped);
+
+    // Invalid tables and arguments
+    TEST_CHECK(stash_umap_set_hash(&mapped, stash_hash_mix, 0) == STASH_ERROR_OUT_OF_BOUNDS);
+    TEST_CHECK(stash_umap_set_max_load_factor(&mapped, 0.5f) == STASH_ERROR_OUT_OF_BOUNDS);
+
+    table = stash_umap_create(0, sizeof(uint64_t));
+    TEST_CHECK(stash_umap_set_hash(&table, NULL, 0) == STASH_ERROR_OUT_OF_BOUNDS);
+    TEST_CHECK(stash_umap_set_max_load_factor(&table, 1.0f) == STASH_ERROR_OUT_OF_BOUNDS);
+    stash_umap_destroy(&table);
+}
+
+int main(void)
+{
+    static const uint32_t sizes[] = { 0, 1, 5, 1000, 20000 };
+
+    for (size_t l = 0; l < LAYOUT_COUNT; l++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            check_round_trip(layouts[l], sizes[s]);
+        }
+        check_damaged(layouts[l]);
+    }
+
+    check_read_only_settings();
+
+    // Missing files and files that are not snapshots
+    stash_umap mapped;
+    TEST_CHECK(stash_umap_map(&mapped, "test_snapshot_missing.tmp", NULL) == STASH_ERROR_IO);
+    TEST_CHECK(map_damaged("not a snapshot", 14) == STASH_ERROR_IO);
+
+    remove(PATH);
+    remove(DAMAGED_PATH);
+
+    return 0;
+}
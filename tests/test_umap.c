@@ -0,0 +1,340 @@
+/*
+ * stash_umap: edge cases of the bucket table, each checked against a reference of which
+ * keys are present.
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_umap.c -o test_umap && ./test_umap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+static const uint32_t layouts[] = {
+    STASH_UMAP_INLINE,
+    STASH_UMAP_SPLIT,
+    STASH_UMAP_INCREMENTAL,
+    STASH_UMAP_ORDERED,
+    STASH_UMAP_SMALL,
+};
+
+#define LAYOUT_COUNT (sizeof(layouts) / sizeof(layouts[0]))
+
+static uint64_t hash_constant(const void* key, size_t size, uint64_t seed)
+{
+    (void)key;
+    (void)size;
+    (void)seed;
+    return 0x5bd1e995;
+}
+
+static void check_contents(const stash_umap* table, const uint32_t* keys, const uint8_t* present, size_t n)
+{
+    size_t count = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t value = 0;
+        int ret = stash_umap_get(table, keys[i], &value);
+
+        TEST_CHECK(ret == (present[i] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+        if (present[i]) TEST_CHECK(value == keys[i] * 3ull);
+        count += present[i];
+    }
+
+    TEST_CHECK(stash_umap_count(table) == count);
+}
+
+static void check_collisions(uint32_t flags, stash_hash_fn hash, uint32_t shift, size_t n)
+{
+    // Runs far longer than a slot can record must neither grow the table nor lose keys
+    static uint32_t keys[2000];
+    static uint8_t present[2000];
+
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+    TEST_CHECK(stash_umap_set_hash(&table, hash, 0) == STASH_SUCCESS);
+
+    for (size_t i = 0; i < n; i++) {
+        keys[i] = (uint32_t)(i + 1) << shift;
+        uint64_t value = keys[i] * 3ull;
+        TEST_CHECK(stash_umap_insert(&table, keys[i], &value) == STASH_SUCCESS);
+        present[i] = 1;
+    }
+
+    stash_umap_info info;
+    TEST_CHECK(stash_umap_stats(&table, &info) == STASH_SUCCESS);
+    TEST_CHECK(info.bucket_count <= 4 * n + 64);
+    check_contents(&table, keys, present, n);
+
+    // Removals pull back saturated entries, every other key goes away
+    for (size_t i = 0; i < n; i += 2) {
+        TEST_CHECK(stash_umap_remove(&table, keys[i], NULL) == STASH_SUCCESS);
+        present[i] = 0;
+    }
+    check_contents(&table, keys, present, n);
+
+    for (size_t i = 0; i < n; i += 4) {
+        uint64_t value = keys[i] * 3ull;
+        TEST_CHECK(stash_umap_insert(&table, keys[i], &value) == STASH_SUCCESS);
+        present[i] = 1;
+    }
+    check_contents(&table, keys, present, n);
+
+    stash_umap_destroy(&table);
+}
+
+static uint64_t hash_coarse(const void* key, size_t size, uint64_t seed)
+{
+    // Four homes only, so runs stay far longer than a slot can record
+    uint32_t k;
+    (void)size;
+    (void)seed;
+    memcpy(&k, key, sizeof(k));
+    return (uint64_t)(k % 4) * 0x9E3779B97F4A7C15ULL;
+}
+
+static void check_random_collisions(uint32_t flags)
+{
+    static uint32_t keys[1000];
+    static uint8_t present[1000];
+    uint64_t state = 42;
+
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+    TEST_CHECK(stash_umap_set_hash(&table, hash_coarse, 0) == STASH_SUCCESS);
+
+    for (size_t i = 0; i < 1000; i++) {
+        keys[i] = (uint32_t)i;
+        present[i] = 0;
+    }
+
+    for (int op = 0; op < 20000; op++) {
+        size_t i = (size_t)(test_rand(&state) % 1000);
+        uint64_t value = keys[i] * 3ull;
+
+        if (test_rand(&state) % 3 == 0) {
+            TEST_CHECK(stash_umap_remove(&table, keys[i], NULL) == (present[i] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+            present[i] = 0;
+        }
+        else {
+            TEST_CHECK(stash_umap_insert(&table, keys[i], &value) == (present[i] ? STASH_KEY_EXISTS : STASH_SUCCESS));
+            present[i] = 1;
+        }
+
+        if (op % 2000 == 0) check_contents(&table, keys, present, 1000);
+    }
+    check_contents(&table, keys, present, 1000);
+
+    stash_umap_destroy(&table);
+}
+
+static void check_wide_keys(stash_hash_fn hash)
+{
+    // Grid keys with swapped and repeated words must spread, not pile up in a few runs
+    typedef struct { uint64_t words[2]; } pair_key;
+
+    stash_umap table = stash_umap_create_keyed(0, sizeof(pair_key), 0, STASH_UMAP_INLINE);
+    TEST_CHECK(stash_umap_set_hash(&table, hash, 0) == STASH_SUCCESS);
+
+    for (uint64_t i = 0; i < 200; i++) {
+        for (uint64_t j = 0; j < 200; j++) {
+            pair_key key = { { i, j } };
+            bool inserted = false;
+            TEST_CHECK(stash_umap_emplace_key(&table, &key, &inserted) && inserted);
+        }
+    }
+
+    stash_umap_info info;
+    TEST_CHECK(stash_umap_stats(&table, &info) == STASH_SUCCESS);
+    TEST_CHECK(info.avg_probe < 3.0f);     //< About 2 for a random hash at this load
+
+    pair_key swapped = { { 1, 2 } }, reversed = { { 2, 1 } };
+    TEST_CHECK(hash(&swapped, sizeof(swapped), 0) != hash(&reversed, sizeof(reversed), 0));
+
+    stash_umap_destroy(&table);
+}
+
+static void check_build_duplicates(uint32_t flags)
+{
+    // Bulk construction keeps the first value given for each key
+    static uint32_t keys[5000];
+    static uint64_t values[5000];
+    static int64_t first[1000];
+    uint64_t state = 42;
+    size_t distinct = 0;
+
+    for (size_t k = 0; k < 1000; k++) {
+        first[k] = -1;
+    }
+
+    for (size_t i = 0; i < 5000; i++) {
+        keys[i] = (uint32_t)(test_rand(&state) % 1000);
+        values[i] = i;
+        if (first[keys[i]] < 0) {
+            first[keys[i]] = (int64_t)i;
+            distinct++;
+        }
+    }
+
+    stash_umap table = stash_umap_build_keyed(keys, sizeof(uint32_t), values, 5000, sizeof(uint64_t), flags);
+    TEST_CHECK(stash_umap_is_valid(&table));
+    TEST_CHECK(stash_umap_count(&table) == distinct);
+
+    for (uint32_t k = 0; k < 1000; k++) {
+        uint64_t value = 0;
+        TEST_CHECK(stash_umap_get(&table, k, &value) == (first[k] >= 0 ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+        if (first[k] >= 0) TEST_CHECK(value == (uint64_t)first[k]);
+    }
+    TEST_CHECK(!stash_umap_contains(&table, 1000));
+
+    stash_umap_destroy(&table);
+
+    // Every key given twice in a row, both copies near the end of the bucket array too
+    for (size_t i = 0; i < 5000; i++) {
+        keys[i] = (uint32_t)(i / 2);
+    }
+
+    table = stash_umap_build_keyed(keys, sizeof(uint32_t), values, 5000, sizeof(uint64_t), flags);
+    TEST_CHECK(stash_umap_count(&table) == 2500);
+
+    for (uint32_t k = 0; k < 2500; k++) {
+        uint64_t value = 0;
+        TEST_CHECK(stash_umap_get(&table, k, &value) == STASH_SUCCESS && value == k * 2ull);
+    }
+
+    stash_umap_destroy(&table);
+}
+
+static void check_shrink(uint32_t flags)
+{
+    // After 90% of the keys are gone the bucket array falls to the smallest that fits
+    static uint32_t keys[50000];
+    static uint8_t present[50000];
+
+    stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+
+    for (uint32_t i = 0; i < 50000; i++) {
+        keys[i] = i * 11;
+        uint64_t value = keys[i] * 3ull;
+        TEST_CHECK(stash_umap_insert(&table, keys[i], &value) == STASH_SUCCESS);
+        present[i] = 1;
+    }
+
+    stash_umap_info before, after;
+    TEST_CHECK(stash_umap_stats(&table, &before) == STASH_SUCCESS);
+
+    for (uint32_t i = 0; i < 50000; i++) {
+        if (i % 10 != 0) {
+            TEST_CHECK(stash_umap_remove(&table, keys[i], NULL) == STASH_SUCCESS);
+            present[i] = 0;
+        }
+    }
+
+    TEST_CHECK(stash_umap_shrink_to_fit(&table) == STASH_SUCCESS);
+    TEST_CHECK(stash_umap_stats(&table, &after) == STASH_SUCCESS);
+    TEST_CHECK(after.bucket_count * 8 <= before.bucket_count);
+    TEST_CHECK(stash_umap_load_factor(&table) > table.max_load_factor / 2);
+    check_contents(&table, keys, present, 50000);
+
+    // Ordered tables keep the insertion order of the survivors
+    if (flags & STASH_UMAP_ORDERED) {
+        uint32_t i = 0;
+        for (stash_it it = stash_umap_begin(&table); it.curr != NULL; stash_umap_next(&table, &it), i += 10) {
+            uint64_t value;
+            memcpy(&value, it.curr, sizeof(value));
+            TEST_CHECK(value == keys[i] * 3ull);
+        }
+        TEST_CHECK(i == 50000);
+    }
+
+    // A second shrink has nothing left to do, and the table still grows afterwards
+    TEST_CHECK(stash_umap_shrink_to_fit(&table) == STASH_SUCCESS);
+    TEST_CHECK(stash_umap_stats(&table, &before) == STASH_SUCCESS && before.bucket_count == after.bucket_count);
+
+    for (uint32_t i = 1; i < 50000; i += 10) {
+        uint64_t value = keys[i] * 3ull;
+        TEST_CHECK(stash_umap_insert(&table, keys[i], &value) == STASH_SUCCESS);
+        present[i] = 1;
+    }
+    check_contents(&table, keys, present, 50000);
+
+    stash_umap_destroy(&table);
+}
+
+static void check_small_boundary(uint32_t flags)
+{
+    // Tables hover around the inline capacity: promotion happens on the first key that does
+    // not fit, right after removals that made room, and removals continue once promoted
+    static const uint32_t keys[] = { 5, 900, 17, 3, 64, 1u << 31, 77, 12, 40, 8, 2, 1000000 };
+    enum { KEY_COUNT = sizeof(keys) / sizeof(keys[0]) };
+    uint64_t state = 7;
+    int promoted = 0;
+
+    for (int trial = 0; trial < 500; trial++) {
+        stash_umap table = stash_umap_create_ex(0, sizeof(uint64_t), flags);
+        uint8_t present[KEY_COUNT] = { 0 };
+        uint32_t order[KEY_COUNT];
+        size_t count = 0;
+
+        for (int op = 0; op < 60; op++) {
+            size_t i = (size_t)(test_rand(&state) % KEY_COUNT);
+            uint64_t value = keys[i] * 3ull;
+            bool small = (table.flags & STASH_UMAP_SMALL) != 0;
+
+            if (test_rand(&state) % 3 == 0) {
+                uint64_t removed = 0;
+                TEST_CHECK(stash_umap_remove(&table, keys[i], &removed) == (present[i] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+                if (present[i]) {
+                    TEST_CHECK(removed == value);
+                    size_t at = 0;
+                    while (order[at] != keys[i]) at++;
+                    memmove(&order[at], &order[at + 1], (--count - at) * sizeof(uint32_t));
+                }
+                present[i] = 0;
+            }
+            else {
+                TEST_CHECK(stash_umap_insert(&table, keys[i], &value) == (present[i] ? STASH_KEY_EXISTS : STASH_SUCCESS));
+                if (!present[i]) order[count++] = keys[i];
+                present[i] = 1;
+            }
+
+            // Promotion is one way, and only the key that does not fit triggers it
+            if (!small) TEST_CHECK(!(table.flags & STASH_UMAP_SMALL));
+            TEST_CHECK(((table.flags & STASH_UMAP_SMALL) != 0) == (small && count <= STASH_UMAP_SMALL_SIZE));
+            check_contents(&table, keys, present, KEY_COUNT);
+
+            // While inline, the keys are iterated in insertion order
+            if (table.flags & STASH_UMAP_SMALL) {
+                size_t n = 0;
+                for (stash_it it = stash_umap_begin(&table); it.curr != NULL; stash_umap_next(&table, &it), n++) {
+                    uint64_t v;
+                    memcpy(&v, it.curr, sizeof(v));
+                    TEST_CHECK(n < count && v == order[n] * 3ull);
+                }
+                TEST_CHECK(n == count);
+            }
+        }
+
+        promoted += !(table.flags & STASH_UMAP_SMALL);
+        stash_umap_destroy(&table);
+    }
+
+    TEST_CHECK(promoted > 0 && promoted < 500);
+}
+
+int main(void)
+{
+    for (size_t l = 0; l < LAYOUT_COUNT; l++) {
+        check_collisions(layouts[l], hash_constant, 0, 2000);
+        check_collisions(layouts[l], stash_hash_identity, 20, 300);
+        check_random_collisions(layouts[l]);
+        check_build_duplicates(layouts[l]);
+        check_shrink(layouts[l]);
+    }
+
+    check_small_boundary(STASH_UMAP_SMALL);
+    check_small_boundary(STASH_UMAP_SMALL | STASH_UMAP_SPLIT);
+    check_small_boundary(STASH_UMAP_SMALL | STASH_UMAP_INCREMENTAL);
+
+    check_wide_keys(stash_hash_identity);
+    check_wide_keys(stash_hash_fibonacci);
+
+    return 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * stash_umultimap: random inserts and removals against a reference of per-key value
+ * lists, checking insertion order within each key and that compaction keeps every run.
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_umultimap.c -o test_umultimap && ./test_umultimap
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#define KEYS 500
+#define OPS 200000
+
+typedef struct {
+    uint64_t* values;
+    size_t count;
+    size_t capacity;
+} list;
+
+static list reference[KEYS];
+static size_t total;
+
+static void check_key(const stash_umultimap* map, uint32_t key)
+{
+    size_t count;
+    const uint64_t* values = (const uint64_t*)stash_umultimap_equal_range_const(map, key, &count);
+    const list* ref = &reference[key];
+
+    TEST_CHECK(count == ref->count);
+    TEST_CHECK(stash_umultimap_contains(map, key) == (ref->count > 0));
+    TEST_CHECK((values != NULL) == (ref->count > 0));
+    if (count > 0) TEST_CHECK(memcmp(values, ref->values, count * sizeof(uint64_t)) == 0);
+}
+
+static void visit(uint32_t key, void* value, void* user)
+{
+    size_t* seen = (size_t*)user;
+    uint64_t v;
+    memcpy(&v, value, sizeof(v));
+
+    // Values of a key come in insertion order
+    TEST_CHECK(key < KEYS && seen[key] < reference[key].count);
+    TEST_CHECK(v == reference[key].values[seen[key]]);
+    seen[key]++;
+}
+
+static void check_all(stash_umultimap* map)
+{
+    size_t keys = 0;
+    for (uint32_t key = 0; key < KEYS; key++) {
+        check_key(map, key);
+        keys += reference[key].count > 0;
+    }
+
+    TEST_CHECK(stash_umultimap_count(map) == total);
+    TEST_CHECK(stash_umultimap_key_count(map) == keys);
+
+    static size_t seen[KEYS];
+    memset(seen, 0, sizeof(seen));
+    stash_umultimap_for_each(map, visit, seen);
+    for (uint32_t key = 0; key < KEYS; key++) {
+        TEST_CHECK(seen[key] == reference[key].count);
+    }
+}
+
+int main(void)
+{
+    stash_umultimap map = stash_umultimap_create(0, sizeof(uint64_t));
+    TEST_CHECK(stash_umultimap_is_valid(&map));
+
+    uint64_t state = 42;
+    size_t compactions = 0;
+
+    for (uint64_t i = 0; i < OPS; i++) {
+        uint64_t r = test_rand(&state);
+        uint32_t key = (uint32_t)(r % KEYS);
+        list* ref = &reference[key];
+        size_t garbage = map.garbage;
+
+        // Removals of whole keys are rare, so runs get long enough to move around
+        switch ((r >> 32) % 20) {
+        case 0: {
+            TEST_CHECK(stash_umultimap_remove(&map, key) == (ref->count ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+            total -= ref->count;
+            ref->count = 0;
+            break;
+        }
+        case 1: case 2: case 3: case 4: case 5: case 6: {
+            size_t index = ref->count ? (size_t)(r >> 40) % (ref->count + 1) : 0;
+            uint64_t removed = 0;
+            int ret = stash_umultimap_remove_at(&map, key, index, &removed);
+
+            if (ref->count == 0) {
+                TEST_CHECK(ret == STASH_ERROR_KEY_NOT_FOUND);
+            }
+            else if (index == ref->count) {
+                TEST_CHECK(ret == STASH_ERROR_OUT_OF_BOUNDS);
+            }
+            else {
+                TEST_CHECK(ret == STASH_SUCCESS && removed == ref->values[index]);
+                memmove(ref->values + index, ref->values + index + 1, (ref->count - index - 1) * sizeof(uint64_t));
+                ref->count--;
+                total--;
+            }
+            break;
+        }
+        default: {
+            uint64_t value = ((uint64_t)key << 32) | i;
+            TEST_CHECK(stash_umultimap_insert(&map, key, &value) == STASH_SUCCESS);
+
+            if (ref->count == ref->capacity) {
+                ref->capacity = ref->capacity ? ref->capacity * 2 : 4;
+                ref->values = (uint64_t*)realloc(ref->values, ref->capacity * sizeof(uint64_t));
+                TEST_CHECK(ref->values != NULL);
+            }
+            ref->values[ref->count++] = value;
+            total++;
+            break;
+        }
+        }
+
+        // Compaction packs the runs back to back
+        if (map.garbage == 0 && garbage >= 64) {
+            TEST_CHECK(map.values.count == total);
+            compactions++;
+        }
+        TEST_CHECK(map.garbage <= map.values.count);
+
+        check_key(&map, key);
+        if (i % 10000 == 0) check_all(&map);
+    }
+
+    check_all(&map);
+    TEST_CHECK(compactions > 0);
+
+    // Draining every key one value at a time empties the map
+    for (uint32_t key = 0; key < KEYS; key++) {
+        while (reference[key].count > 0) {
+            uint64_t removed;
+            TEST_CHECK(stash_umultimap_remove_at(&map, key, 0, &removed) == STASH_SUCCESS);
+            TEST_CHECK(removed == reference[key].values[0]);
+            memmove(reference[key].values, reference[key].values + 1, --reference[key].count * sizeof(uint64_t));
+            total--;
+        }
+    }
+    check_all(&map);
+    TEST_CHECK(stash_umultimap_count(&map) == 0 && stash_umultimap_key_count(&map) == 0);
+
+    // Clear drops everything at once
+    for (uint32_t key = 0; key < 100; key++) {
+        uint64_t value = key;
+        TEST_CHECK(stash_umultimap_insert(&map, key % 10, &value) == STASH_SUCCESS);
+    }
+    stash_umultimap_clear(&map);
+    TEST_CHECK(stash_umultimap_count(&map) == 0 && !stash_umultimap_contains(&map, 0));
+
+    stash_umultimap_destroy(&map);
+    TEST_CHECK(!stash_umultimap_is_valid(&map));
+
+    for (uint32_t key = 0; key < KEYS; key++) {
+        free(reference[key].values);
+    }
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * stash_uset: union, intersection and difference of random sets against a bitmap
+ * reference, with either operand the larger one, and aliased operands.
+ *
+ *   cc -std=c99 -g -fsanitize=address,undefined -I. tests/test_uset.c -o test_uset && ./test_uset
+ */
+
+#define STASH_IMPL
+#include "stash.h"
+#include "tests/test.h"
+
+#define UNIVERSE 4096
+
+typedef struct {
+    uint8_t has[UNIVERSE];
+    size_t count;
+} reference;
+
+static uint64_t state = 42;
+
+static void fill(stash_uset* set, reference* ref, size_t n)
+{
+    memset(ref, 0, sizeof(*ref));
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t key = (uint32_t)(test_rand(&state) % UNIVERSE);
+        int ret = stash_uset_insert(set, key);
+
+        TEST_CHECK(ret == (ref->has[key] ? STASH_KEY_EXISTS : STASH_SUCCESS));
+        ref->count += !ref->has[key];
+        ref->has[key] = 1;
+    }
+}
+
+static void visit(uint32_t key, void* value, void* user)
+{
+    uint8_t* seen = (uint8_t*)user;
+    (void)value;
+
+    TEST_CHECK(key < UNIVERSE && !seen[key]);
+    seen[key] = 1;
+}
+
+static void check(const stash_uset* set, const reference* ref)
+{
+    TEST_CHECK(stash_uset_count(set) == ref->count);
+
+    for (uint32_t key = 0; key < UNIVERSE; key++) {
+        TEST_CHECK(stash_uset_contains(set, key) == (ref->has[key] != 0));
+    }
+
+    // Every key is visited once
+    static uint8_t seen[UNIVERSE];
+    memset(seen, 0, sizeof(seen));
+    stash_uset_for_each(set, visit, seen);
+    TEST_CHECK(memcmp(seen, ref->has, sizeof(seen)) == 0);
+}
+
+static void check_algebra(size_t n, size_t m)
+{
+    static reference ra, rb, expected;
+    stash_uset a = stash_uset_create(0);
+    stash_uset b = stash_uset_create(0);
+
+    for (int op = 0; op < 3; op++) {
+        stash_uset_clear(&a);
+        stash_uset_clear(&b);
+        fill(&a, &ra, n);
+        fill(&b, &rb, m);
+
+        memset(&expected, 0, sizeof(expected));
+        for (uint32_t key = 0; key < UNIVERSE; key++) {
+            switch (op) {
+            case 0: expected.has[key] = ra.has[key] | rb.has[key]; break;
+            case 1: expected.has[key] = ra.has[key] & rb.has[key]; break;
+            default: expected.has[key] = ra.has[key] & !rb.has[key]; break;
+            }
+            expected.count += expected.has[key];
+        }
+
+        int ret;
+        switch (op) {
+        case 0: ret = stash_uset_union(&a, &b); break;
+        case 1: ret = stash_uset_intersection(&a, &b); break;
+        default: ret = stash_uset_difference(&a, &b); break;
+        }
+
+        TEST_CHECK(ret == STASH_SUCCESS);
+        check(&a, &expected);
+        check(&b, &rb);     //< The other operand is left alone
+    }
+
+    stash_uset_destroy(&a);
+    stash_uset_destroy(&b);
+}
+
+int main(void)
+{
+    static reference ref;
+
+    // Both operands empty, either one larger, and both about the same size
+    static const size_t sizes[][2] = { { 0, 0 }, { 0, 500 }, { 500, 0 }, { 3000, 200 }, { 200, 3000 }, { 2000, 2000 } };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        check_algebra(sizes[i][0], sizes[i][1]);
+    }
+
+    // A set combined with itself
+    stash_uset set = stash_uset_create(0);
+    fill(&set, &ref, 1000);
+
+    TEST_CHECK(stash_uset_union(&set, &set) == STASH_SUCCESS);
+    check(&set, &ref);
+    TEST_CHECK(stash_uset_intersection(&set, &set) == STASH_SUCCESS);
+    check(&set, &ref);
+    TEST_CHECK(stash_uset_difference(&set, &set) == STASH_SUCCESS);
+    TEST_CHECK(stash_uset_count(&set) == 0);
+
+    // Removal
+    fill(&set, &ref, 1000);
+    for (uint32_t key = 0; key < UNIVERSE; key += 3) {
+        TEST_CHECK(stash_uset_remove(&set, key) == (ref.has[key] ? STASH_SUCCESS : STASH_ERROR_KEY_NOT_FOUND));
+        ref.count -= ref.has[key];
+        ref.has[key] = 0;
+    }
+    check(&set, &ref);
+
+    // A rebuilt set keeps its own hash and load factor
+    stash_uset small = stash_uset_create(0);
+    for (uint32_t key = 0; key < UNIVERSE; key += 2) stash_uset_insert(&small, key);
+
+    TEST_CHECK(stash_umap_set_hash(&set.table, stash_hash_fibonacci, 7) == STASH_SUCCESS);
+    TEST_CHECK(stash_umap_set_max_load_factor(&set.table, 0.5f) == STASH_SUCCESS);
+    TEST_CHECK(stash_uset_intersection(&set, &small) == STASH_SUCCESS);
+    TEST_CHECK(set.table.hash == stash_hash_fibonacci && set.table.seed == 7);
+    TEST_CHECK(set.table.max_load_factor == 0.5f && stash_umap_load_factor(&set.table) <= 0.5f);
+
+    stash_uset_destroy(&small);
+    stash_uset_destroy(&set);
+
+    TEST_CHECK(!stash_uset_is_valid(&set));
+    TEST_CHECK(stash_uset_insert(&set, 1) == STASH_ERROR_OUT_OF_MEMORY);
+    TEST_CHECK(!stash_uset_contains(&set, 1));
+
+    return 0;
+}